@@ -3,231 +3,781 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#define LINE_MIN_CAPACITY 16
+#define MAX_RECORDED_EDITS 4096
+
+static char empty_line[1] = "";
+
+static size_t map_threshold = 0;
+
+// Buffers whose original text is a file mapping, for the SIGBUS handler
+static TextBuffer **mapped_buffers = NULL;
+static int mapped_count = 0;
+static int mapped_capacity = 0;
+static bool sigbus_guard_installed = false;
+static size_t page_size = 0;
+
+void buffer_set_map_threshold(size_t bytes) {
+    map_threshold = bytes;
+}
+
+// Reading a mapped page that now lies past the end of a truncated file
+// raises SIGBUS. Replace the rest of that mapping with zero pages so the
+// read completes, and flag the buffer so the editor reloads it. Faults
+// anywhere else get the default action.
+//
+// mmap is not on the POSIX list of async-signal-safe functions. Replacing
+// pages with MAP_FIXED from a handler for a synchronous fault is relied on
+// as Linux behaviour: the call is a single system call that takes no
+// user-space locks, and the faulting read is retried once it returns.
+static void sigbus_handler(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    char *addr = info->si_addr;
+    for (int i = 0; i < mapped_count; i++) {
+        TextBuffer *buffer = mapped_buffers[i];
+        char *start = buffer->original;
+        if (addr < start || addr >= start + buffer->original_size) continue;
+
+        char *from = start + ((size_t)(addr - start) & ~(page_size - 1));
+        size_t length = start + buffer->original_size - from;
+        if (mmap(from, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                 -1, 0) == MAP_FAILED) {
+            break;
+        }
+        buffer->original_lost = 1;
+        return;
+    }
+
+    // Returning re-runs the faulting access, which now gets the default
+    // action
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+static bool track_mapping(TextBuffer *buffer) {
+    if (!sigbus_guard_installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = sigbus_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGBUS, &sa, NULL) != 0) return false;
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+        sigbus_guard_installed = true;
+    }
+    if (mapped_count >= mapped_capacity) {
+        int new_capacity = mapped_capacity == 0 ? 4 : mapped_capacity * 2;
+        TextBuffer **grown = realloc(mapped_buffers, sizeof(TextBuffer *) * new_capacity);
+        if (!grown) return false;
+        mapped_buffers = grown;
+        mapped_capacity = new_capacity;
+    }
+    mapped_buffers[mapped_count++] = buffer;
+    return true;
+}
+
+static void untrack_mapping(TextBuffer *buffer) {
+    for (int i = 0; i < mapped_count; i++) {
+        if (mapped_buffers[i] == buffer) {
+            mapped_buffers[i] = mapped_buffers[--mapped_count];
+            return;
+        }
+    }
+}
 
 TextBuffer *buffer_create(void) {
     TextBuffer *buffer = malloc(sizeof(TextBuffer));
     if (!buffer) return NULL;
-    
+
     buffer->lines = NULL;
     buffer->line_count = 0;
     buffer->line_capacity = 0;
-    
+    buffer->gap_start = 0;
+    buffer->original = NULL;
+    buffer->original_size = 0;
+    buffer->original_mapped = false;
+    buffer->original_lost = 0;
+    buffer->edits = NULL;
+    buffer->edit_count = 0;
+    buffer->edit_capacity = 0;
+    buffer->edits_valid = false;
+
     return buffer;
 }
 
-void buffer_free(TextBuffer *buffer) {
-    if (!buffer) return;
-    
+static int gap_end(const TextBuffer *buffer) {
+    return buffer->gap_start + (buffer->line_capacity - buffer->line_count);
+}
+
+// Map a logical row to its slot in the gap array
+static BufferLine *line_at(const TextBuffer *buffer, int row) {
+    if (row < buffer->gap_start) return &buffer->lines[row];
+    return &buffer->lines[row + (buffer->line_capacity - buffer->line_count)];
+}
+
+static void line_release(BufferLine *line) {
+    if (line->cap > 0) free(line->text);
+    line->text = empty_line;
+    line->len = 0;
+    line->cap = 0;
+}
+
+static void buffer_clear(TextBuffer *buffer) {
     for (int i = 0; i < buffer->line_count; i++) {
-        free(buffer->lines[i]);
+        line_release(line_at(buffer, i));
     }
-    
     free(buffer->lines);
+    if (buffer->original_mapped) {
+        untrack_mapping(buffer);
+        munmap(buffer->original, buffer->original_size);
+    } else {
+        free(buffer->original);
+    }
+    buffer->lines = NULL;
+    buffer->line_count = 0;
+    buffer->line_capacity = 0;
+    buffer->gap_start = 0;
+    buffer->original = NULL;
+    buffer->original_size = 0;
+    buffer->original_mapped = false;
+    buffer->original_lost = 0;
+}
+
+static void buffer_drop_edits(TextBuffer *buffer) {
+    for (int i = 0; i < buffer->edit_count; i++) {
+        free(buffer->edits[i].text);
+    }
+    buffer->edit_count = 0;
+}
+
+void buffer_reset_edits(TextBuffer *buffer) {
+    if (!buffer) return;
+    buffer_drop_edits(buffer);
+    buffer->edits_valid = true;
+}
+
+static void buffer_invalidate_edits(TextBuffer *buffer) {
+    buffer_drop_edits(buffer);
+    buffer->edits_valid = false;
+}
+
+// Try to fold a single-line edit into the previous one so that typing or
+// backspacing a run of characters is recorded as one change
+static bool buffer_extend_edit(TextBuffer *buffer, int row, int start_col, int end_col,
+                               const char *text, int text_len) {
+    if (buffer->edit_count == 0) return false;
+    BufferEdit *last = &buffer->edits[buffer->edit_count - 1];
+    if (last->start_row != row || last->end_row != row) return false;
+    if (memchr(last->text, '\n', last->text_len) || memchr(text, '\n', text_len)) return false;
+
+    if (start_col == end_col && last->start_col + last->text_len == start_col) {
+        // Typing right after the previous insertion
+        char *grown = realloc(last->text, last->text_len + text_len + 1);
+        if (!grown) return false;
+        memcpy(grown + last->text_len, text, text_len);
+        last->text = grown;
+        last->text_len += text_len;
+        last->text[last->text_len] = '\0';
+        return true;
+    }
+    if (text_len == 0 && last->text_len == 0) {
+        if (end_col == last->start_col) {
+            // Backspace before the previous deletion
+            last->start_col = start_col;
+            return true;
+        }
+        if (start_col == last->start_col) {
+            // Forward delete at the same position
+            last->end_col += end_col - start_col;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void buffer_record_edit(TextBuffer *buffer, int start_row, int start_col,
+                               int end_row, int end_col, const char *text, int text_len) {
+    if (!buffer->edits_valid) return;
+
+    if (start_row == end_row &&
+        buffer_extend_edit(buffer, start_row, start_col, end_col, text, text_len)) {
+        return;
+    }
+
+    // Past this point resending the document is cheaper than replaying edits
+    if (buffer->edit_count >= MAX_RECORDED_EDITS) {
+        buffer_invalidate_edits(buffer);
+        return;
+    }
+
+    if (buffer->edit_count >= buffer->edit_capacity) {
+        int new_cap = buffer->edit_capacity == 0 ? 16 : buffer->edit_capacity * 2;
+        BufferEdit *new_edits = realloc(buffer->edits, new_cap * sizeof(BufferEdit));
+        if (!new_edits) {
+            buffer_invalidate_edits(buffer);
+            return;
+        }
+        buffer->edits = new_edits;
+        buffer->edit_capacity = new_cap;
+    }
+
+    char *copy = malloc(text_len + 1);
+    if (!copy) {
+        buffer_invalidate_edits(buffer);
+        return;
+    }
+    if (text_len > 0) memcpy(copy, text, text_len);
+    copy[text_len] = '\0';
+
+    BufferEdit *edit = &buffer->edits[buffer->edit_count++];
+    edit->start_row = start_row;
+    edit->start_col = start_col;
+    edit->end_row = end_row;
+    edit->end_col = end_col;
+    edit->text = copy;
+    edit->text_len = text_len;
+}
+
+void buffer_free(TextBuffer *buffer) {
+    if (!buffer) return;
+
+    buffer_clear(buffer);
+    buffer_drop_edits(buffer);
+    free(buffer->edits);
     free(buffer);
 }
 
+static void buffer_move_gap(TextBuffer *buffer, int row) {
+    int gap_len = buffer->line_capacity - buffer->line_count;
+    if (row < buffer->gap_start) {
+        memmove(buffer->lines + row + gap_len, buffer->lines + row,
+                (buffer->gap_start - row) * sizeof(BufferLine));
+    } else if (row > buffer->gap_start) {
+        memmove(buffer->lines + buffer->gap_start, buffer->lines + gap_end(buffer),
+                (row - buffer->gap_start) * sizeof(BufferLine));
+    }
+    buffer->gap_start = row;
+}
+
 static bool buffer_ensure_capacity(TextBuffer *buffer, int needed_lines) {
     if (needed_lines <= buffer->line_capacity) return true;
-    
+
     int new_capacity = buffer->line_capacity == 0 ? 8 : buffer->line_capacity * 2;
     while (new_capacity < needed_lines) {
         new_capacity *= 2;
     }
-    
-    char **new_lines = realloc(buffer->lines, new_capacity * sizeof(char*));
+
+    BufferLine *new_lines = malloc(new_capacity * sizeof(BufferLine));
     if (!new_lines) return false;
-    
+
+    // Keep the gap where it is; the tail moves to the end of the new array
+    int tail = buffer->line_count - buffer->gap_start;
+    if (buffer->lines) {
+        memcpy(new_lines, buffer->lines, buffer->gap_start * sizeof(BufferLine));
+        memcpy(new_lines + new_capacity - tail, buffer->lines + gap_end(buffer),
+               tail * sizeof(BufferLine));
+    }
+    free(buffer->lines);
+
     buffer->lines = new_lines;
     buffer->line_capacity = new_capacity;
     return true;
 }
 
+// Open a slot for a new line at row and return it
+static BufferLine *buffer_open_line(TextBuffer *buffer, int row) {
+    if (!buffer_ensure_capacity(buffer, buffer->line_count + 1)) return NULL;
+
+    buffer_move_gap(buffer, row);
+    BufferLine *line = &buffer->lines[buffer->gap_start];
+    buffer->gap_start++;
+    buffer->line_count++;
+
+    line->text = empty_line;
+    line->len = 0;
+    line->cap = 0;
+    return line;
+}
+
+// Replace a line's bytes with a new heap block made of two spans
+static bool line_replace(BufferLine *line, const char *a, int a_len, const char *b, int b_len) {
+    int cap = a_len + b_len;
+    if (cap < LINE_MIN_CAPACITY) cap = LINE_MIN_CAPACITY;
+
+    char *text = malloc(cap);
+    if (!text) return false;
+
+    if (a_len > 0) memcpy(text, a, a_len);
+    if (b_len > 0) memcpy(text + a_len, b, b_len);
+
+    line_release(line);
+    line->text = text;
+    line->len = a_len + b_len;
+    line->cap = cap;
+    return true;
+}
+
+// Make the line writable with room for at least needed bytes, growing
+// geometrically so repeated edits on one line are amortized O(1)
+static bool line_reserve(BufferLine *line, int needed) {
+    if (line->cap > 0 && needed <= line->cap) return true;
+
+    int cap = line->cap > 0 ? line->cap * 2 : line->len * 2;
+    if (cap < LINE_MIN_CAPACITY) cap = LINE_MIN_CAPACITY;
+    while (cap < needed) {
+        cap *= 2;
+    }
+
+    if (line->cap > 0) {
+        char *text = realloc(line->text, cap);
+        if (!text) return false;
+        line->text = text;
+    } else {
+        char *text = malloc(cap);
+        if (!text) return false;
+        if (line->len > 0) memcpy(text, line->text, line->len);
+        line->text = text;
+    }
+    line->cap = cap;
+    return true;
+}
+
+// Read a file that cannot be mapped (pipes, special files) into a heap block
+static bool buffer_read_original(TextBuffer *buffer, int fd) {
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *data = malloc(capacity);
+    if (!data) return false;
+
+    for (;;) {
+        if (size == capacity) {
+            char *grown = realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                return false;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, data + size, capacity - size);
+        if (n < 0) {
+            free(data);
+            return false;
+        }
+        if (n == 0) break;
+        size += n;
+    }
+
+    buffer->original = data;
+    buffer->original_size = size;
+    buffer->original_mapped = false;
+    return true;
+}
+
 bool buffer_load_from_file(TextBuffer *buffer, const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) return false;
-    
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    
-    while ((nread = getline(&line, &len, file)) != -1) {
-        if (line[nread - 1] == '\n') {
-            line[nread - 1] = '\0';
-        }
-        buffer_insert_line(buffer, buffer->line_count, line);
-    }
-    
-    free(line);
-    fclose(file);
-    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+
+    buffer_clear(buffer);
+    buffer_invalidate_edits(buffer);
+
+    // Read the file into one heap block by default. Regular files past the
+    // configured size are mapped read-only instead, so only the pages that
+    // are actually read become resident; such a buffer sees later writes to
+    // the file and must be reloaded when it changes.
+    struct stat st;
+    if (map_threshold > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (size_t)st.st_size >= map_threshold) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            buffer->original = map;
+            buffer->original_size = st.st_size;
+            buffer->original_mapped = true;
+            if (!track_mapping(buffer)) {
+                munmap(map, st.st_size);
+                buffer->original = NULL;
+                buffer->original_size = 0;
+                buffer->original_mapped = false;
+            }
+        }
+    }
+    if (!buffer->original_mapped && !buffer_read_original(buffer, fd)) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    char *data = buffer->original;
+    size_t nread = buffer->original_size;
+
+    // Count lines up front so the line array is allocated once
+    int count = 0;
+    for (char *p = data, *end = data + nread; p < end; count++) {
+        char *nl = memchr(p, '\n', end - p);
+        if (!nl) {
+            count++;
+            break;
+        }
+        p = nl + 1;
+    }
+
+    if (count > 0 && !buffer_ensure_capacity(buffer, count)) return false;
+
+    char *p = data;
+    char *end = data + nread;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        int len = nl ? (int)(nl - p) : (int)(end - p);
+        BufferLine *line = &buffer->lines[buffer->line_count++];
+        line->text = p;
+        line->len = len;
+        line->cap = 0;
+        if (!nl) break;
+        p = nl + 1;
+    }
+    buffer->gap_start = buffer->line_count;
+
     if (buffer->line_count == 0) {
         buffer_insert_line(buffer, 0, "");
     }
-    
+
+    return true;
+}
+
+bool buffer_detach_original(TextBuffer *buffer) {
+    if (!buffer->original_mapped) return true;
+
+    char *copy = malloc(buffer->original_size);
+    if (!copy) return false;
+    memcpy(copy, buffer->original, buffer->original_size);
+
+    char *start = buffer->original;
+    char *end = start + buffer->original_size;
+    for (int i = 0; i < buffer->line_count; i++) {
+        BufferLine *line = line_at(buffer, i);
+        if (line->cap == 0 && line->text >= start && line->text < end) {
+            line->text = copy + (line->text - start);
+        }
+    }
+
+    untrack_mapping(buffer);
+    munmap(buffer->original, buffer->original_size);
+    buffer->original = copy;
+    buffer->original_mapped = false;
     return true;
 }
 
 bool buffer_save_to_file(TextBuffer *buffer, const char *filename) {
+    if (!buffer_detach_original(buffer)) return false;
+    // Unedited lines past a truncation read as zeros; writing them out
+    // would replace the file's text
+    if (buffer->original_lost) return false;
+
     FILE *file = fopen(filename, "w");
     if (!file) return false;
-    
+
     for (int i = 0; i < buffer->line_count; i++) {
-        if (buffer->lines[i]) {
-            fprintf(file, "%s", buffer->lines[i]);
+        BufferLine *line = line_at(buffer, i);
+        if (line->len > 0) {
+            fwrite(line->text, 1, line->len, file);
         }
         if (i < buffer->line_count - 1) {
-            fprintf(file, "\n");
+            fputc('\n', file);
         }
     }
-    
+
     fclose(file);
     return true;
 }
 
+const char *buffer_get_line(const TextBuffer *buffer, int row) {
+    if (!buffer || row < 0 || row >= buffer->line_count) return NULL;
+    return line_at(buffer, row)->text;
+}
+
+int buffer_line_length(const TextBuffer *buffer, int row) {
+    if (!buffer || row < 0 || row >= buffer->line_count) return 0;
+    return line_at(buffer, row)->len;
+}
+
 void buffer_insert_char(TextBuffer *buffer, int row, int col, char c) {
     if (row < 0 || row >= buffer->line_count) return;
-    
-    char *line = buffer->lines[row];
-    int len = line ? strlen(line) : 0;
-    
+
+    BufferLine *line = line_at(buffer, row);
+    int len = line->len;
+
     if (col < 0) col = 0;
     if (col > len) col = len;
-    
-    char *new_line = malloc(len + 2);
-    if (!new_line) return;
-    
-    if (line) {
-        memcpy(new_line, line, col);
-        new_line[col] = c;
-        memcpy(new_line + col + 1, line + col, len - col);
-    } else {
-        new_line[0] = c;
-    }
-    new_line[len + 1] = '\0';
-    
-    free(buffer->lines[row]);
-    buffer->lines[row] = new_line;
+
+    if (!line_reserve(line, len + 1)) return;
+
+    memmove(line->text + col + 1, line->text + col, len - col);
+    line->text[col] = c;
+    line->len++;
+
+    buffer_record_edit(buffer, row, col, row, col, &c, 1);
 }
 
 void buffer_delete_char(TextBuffer *buffer, int row, int col) {
     if (row < 0 || row >= buffer->line_count) return;
-    
-    char *line = buffer->lines[row];
-    if (!line) return;
-    
-    int len = strlen(line);
+
+    BufferLine *line = line_at(buffer, row);
+    int len = line->len;
     if (col < 0 || col >= len) return;
-    
-    memmove(line + col, line + col + 1, len - col);
+
+    if (line->cap > 0) {
+        memmove(line->text + col, line->text + col + 1, len - col - 1);
+        line->len--;
+    } else if (!line_replace(line, line->text, col, line->text + col + 1, len - col - 1)) {
+        return;
+    }
+
+    buffer_record_edit(buffer, row, col, row, col + 1, "", 0);
 }
 
 void buffer_insert_newline(TextBuffer *buffer, int row, int col) {
     if (row < 0 || row >= buffer->line_count) return;
-    
-    char *line = buffer->lines[row];
-    int len = line ? strlen(line) : 0;
-    
+
+    BufferLine *line = line_at(buffer, row);
+    int len = line->len;
+
     if (col < 0) col = 0;
     if (col > len) col = len;
-    
-    if (!buffer_ensure_capacity(buffer, buffer->line_count + 1)) return;
-    
-    memmove(buffer->lines + row + 2, buffer->lines + row + 1, 
-            (buffer->line_count - row - 1) * sizeof(char*));
-    
-    char *first_part = malloc(col + 1);
-    char *second_part = malloc(len - col + 1);
-    
-    if (line) {
-        memcpy(first_part, line, col);
-        memcpy(second_part, line + col, len - col);
-    }
-    first_part[col] = '\0';
-    second_part[len - col] = '\0';
-    
-    free(buffer->lines[row]);
-    buffer->lines[row] = first_part;
-    buffer->lines[row + 1] = second_part;
-    buffer->line_count++;
+
+    BufferLine *next = buffer_open_line(buffer, row + 1);
+    if (!next) return;
+    line = line_at(buffer, row);
+
+    if (line->cap > 0) {
+        if (col < len) {
+            line_replace(next, line->text + col, len - col, NULL, 0);
+        }
+    } else {
+        // Both halves of an unedited line still point into the original text
+        next->text = line->text + col;
+        next->len = len - col;
+    }
+    line->len = col;
+
+    buffer_record_edit(buffer, row, col, row, col, "\n", 1);
 }
 
 void buffer_insert_line(TextBuffer *buffer, int row, const char *text) {
     if (row < 0 || row > buffer->line_count) return;
-    
-    if (!buffer_ensure_capacity(buffer, buffer->line_count + 1)) return;
-    
-    memmove(buffer->lines + row + 1, buffer->lines + row, 
-            (buffer->line_count - row) * sizeof(char*));
-    
-    buffer->lines[row] = strdup(text ? text : "");
-    buffer->line_count++;
+
+    BufferLine *line = buffer_open_line(buffer, row);
+    if (!line) return;
+
+    if (text && text[0] != '\0') {
+        line_replace(line, text, strlen(text), NULL, 0);
+    }
+
+    // The new line's text followed by the line break that separates it
+    // from what used to be at row
+    char *inserted = malloc(line->len + 2);
+    if (!inserted) {
+        buffer_invalidate_edits(buffer);
+        return;
+    }
+    memcpy(inserted, line->text, line->len);
+    inserted[line->len] = '\n';
+    buffer_record_edit(buffer, row, 0, row, 0, inserted, line->len + 1);
+    free(inserted);
+}
+
+// Insert a block of text that may span several lines in one pass: the
+// line array is grown and the gap moved once, however many lines are added.
+// The position just after the inserted text is stored in end_row/end_col.
+void buffer_insert_text(TextBuffer *buffer, int row, int col, const char *text, int len,
+                        int *end_row, int *end_col) {
+    if (end_row) *end_row = row;
+    if (end_col) *end_col = col;
+    if (row < 0 || row >= buffer->line_count || !text || len <= 0) return;
+
+    int len_before = line_at(buffer, row)->len;
+    if (col < 0) col = 0;
+    if (col > len_before) col = len_before;
+
+    int new_lines = 0;
+    for (const char *p = text, *end = text + len; (p = memchr(p, '\n', end - p)); p++) {
+        new_lines++;
+    }
+
+    if (new_lines == 0) {
+        BufferLine *line = line_at(buffer, row);
+        if (!line_reserve(line, line->len + len)) return;
+        memmove(line->text + col + len, line->text + col, line->len - col);
+        memcpy(line->text + col, text, len);
+        line->len += len;
+        if (end_col) *end_col = col + len;
+        buffer_record_edit(buffer, row, col, row, col, text, len);
+        return;
+    }
+
+    if (!buffer_ensure_capacity(buffer, buffer->line_count + new_lines)) return;
+    buffer_move_gap(buffer, row + 1);
+    BufferLine *added = &buffer->lines[buffer->gap_start];
+    for (int i = 0; i < new_lines; i++) {
+        added[i].text = empty_line;
+        added[i].len = 0;
+        added[i].cap = 0;
+    }
+    buffer->gap_start += new_lines;
+    buffer->line_count += new_lines;
+
+    BufferLine *line = line_at(buffer, row);
+    const char *first_nl = memchr(text, '\n', len);
+    const char *last_piece = memrchr(text, '\n', len) + 1;
+    int last_len = (int)(text + len - last_piece);
+
+    // The last new line takes the inserted tail plus the rest of the
+    // original line; build it before the original line is modified
+    BufferLine *last = &added[new_lines - 1];
+    if (last_len == 0 && line->cap == 0) {
+        last->text = line->text + col;
+        last->len = line->len - col;
+    } else if (last_len + line->len - col > 0) {
+        line_replace(last, last_piece, last_len, line->text + col, line->len - col);
+    }
+
+    const char *p = first_nl + 1;
+    for (int i = 0; i < new_lines - 1; i++) {
+        const char *nl = memchr(p, '\n', text + len - p);
+        if (nl > p) line_replace(&added[i], p, (int)(nl - p), NULL, 0);
+        p = nl + 1;
+    }
+
+    int first_len = (int)(first_nl - text);
+    line->len = col;
+    if (first_len > 0 && line_reserve(line, col + first_len)) {
+        memcpy(line->text + col, text, first_len);
+        line->len = col + first_len;
+    }
+
+    if (end_row) *end_row = row + new_lines;
+    if (end_col) *end_col = last_len;
+    buffer_record_edit(buffer, row, col, row, col, text, len);
+}
+
+static void buffer_remove_line(TextBuffer *buffer, int row) {
+    buffer_move_gap(buffer, row);
+    line_release(&buffer->lines[gap_end(buffer)]);
+    buffer->line_count--;
 }
 
 void buffer_delete_line(TextBuffer *buffer, int row) {
     if (row < 0 || row >= buffer->line_count) return;
-    
-    free(buffer->lines[row]);
-    memmove(buffer->lines + row, buffer->lines + row + 1, 
-            (buffer->line_count - row - 1) * sizeof(char*));
-    buffer->line_count--;
+
+    buffer_remove_line(buffer, row);
+    buffer_record_edit(buffer, row, 0, row + 1, 0, "", 0);
+}
+
+// Delete the text between two positions in one splice: the start line is
+// joined with the remainder of the end line and every line in between is
+// dropped with a single gap move
+void buffer_delete_range(TextBuffer *buffer, int start_row, int start_col, int end_row, int end_col) {
+    if (start_row < 0 || end_row >= buffer->line_count || start_row > end_row) return;
+    if (start_row == end_row && start_col >= end_col) return;
+
+    BufferLine *first = line_at(buffer, start_row);
+    BufferLine *last = line_at(buffer, end_row);
+    if (start_col < 0) start_col = 0;
+    if (start_col > first->len) start_col = first->len;
+    if (end_col < 0) end_col = 0;
+    if (end_col > last->len) end_col = last->len;
+
+    int tail_len = last->len - end_col;
+    if (start_row == end_row) {
+        if (start_col >= end_col) return;
+        if (first->cap > 0) {
+            memmove(first->text + start_col, first->text + end_col, tail_len);
+            first->len = start_col + tail_len;
+        } else if (tail_len == 0) {
+            first->len = start_col;
+        } else if (!line_replace(first, first->text, start_col, first->text + end_col, tail_len)) {
+            return;
+        }
+    } else {
+        if (tail_len == 0) {
+            first->len = start_col;
+        } else if (first->cap > 0) {
+            if (!line_reserve(first, start_col + tail_len)) return;
+            memcpy(first->text + start_col, last->text + end_col, tail_len);
+            first->len = start_col + tail_len;
+        } else if (!line_replace(first, first->text, start_col, last->text + end_col, tail_len)) {
+            return;
+        }
+
+        int removed = end_row - start_row;
+        buffer_move_gap(buffer, start_row + 1);
+        BufferLine *dropped = &buffer->lines[gap_end(buffer)];
+        for (int i = 0; i < removed; i++) {
+            line_release(&dropped[i]);
+        }
+        buffer->line_count -= removed;
+    }
+
+    buffer_record_edit(buffer, start_row, start_col, end_row, end_col, "", 0);
 }
 
 void buffer_merge_lines(TextBuffer *buffer, int row) {
     if (row < 0 || row >= buffer->line_count - 1) return;
-    
-    char *first = buffer->lines[row];
-    char *second = buffer->lines[row + 1];
-    
-    int first_len = first ? strlen(first) : 0;
-    int second_len = second ? strlen(second) : 0;
-    
-    char *merged = malloc(first_len + second_len + 1);
-    if (!merged) return;
-    
-    if (first) strcpy(merged, first);
-    else merged[0] = '\0';
-    
-    if (second) strcat(merged, second);
-    
-    free(buffer->lines[row]);
-    buffer->lines[row] = merged;
-    
-    buffer_delete_line(buffer, row + 1);
+
+    BufferLine *first = line_at(buffer, row);
+    BufferLine *second = line_at(buffer, row + 1);
+    int first_len = first->len;
+
+    if (second->len > 0) {
+        if (!line_reserve(first, first->len + second->len)) return;
+        memcpy(first->text + first->len, second->text, second->len);
+        first->len += second->len;
+    }
+
+    buffer_remove_line(buffer, row + 1);
+    buffer_record_edit(buffer, row, first_len, row + 1, 0, "", 0);
 }
 
 char *buffer_get_text_range(TextBuffer *buffer, int start_row, int start_col, int end_row, int end_col) {
     if (start_row < 0 || start_row >= buffer->line_count ||
         end_row < 0 || end_row >= buffer->line_count ||
         start_row > end_row) return NULL;
-    
+
     size_t total_size = 0;
     for (int i = start_row; i <= end_row; i++) {
-        char *line = buffer->lines[i];
-        if (line) total_size += strlen(line);
+        total_size += line_at(buffer, i)->len;
         if (i < end_row) total_size++;
     }
     total_size++;
-    
+
     char *result = malloc(total_size);
     if (!result) return NULL;
     char *out = result;
 
     for (int i = start_row; i <= end_row; i++) {
-        char *line = buffer->lines[i];
-        int len = line ? strlen(line) : 0;
+        BufferLine *line = line_at(buffer, i);
+        int len = line->len;
 
         if (i == start_row) {
             int copy_start = (start_col < len) ? start_col : len;
             if (i == end_row) {
                 int copy_end = (end_col < len) ? end_col : len;
                 if (copy_start < copy_end) {
-                    memcpy(out, line + copy_start, copy_end - copy_start);
+                    memcpy(out, line->text + copy_start, copy_end - copy_start);
                     out += copy_end - copy_start;
                 }
             } else {
                 if (copy_start < len) {
-                    memcpy(out, line + copy_start, len - copy_start);
+                    memcpy(out, line->text + copy_start, len - copy_start);
                     out += len - copy_start;
                 }
                 *out++ = '\n';
@@ -235,12 +785,12 @@ char *buffer_get_text_range(TextBuffer *buffer, int start_row, int start_col, in
         } else if (i == end_row) {
             int copy_end = (end_col < len) ? end_col : len;
             if (copy_end > 0) {
-                memcpy(out, line, copy_end);
+                memcpy(out, line->text, copy_end);
                 out += copy_end;
             }
         } else {
             if (len > 0) {
-                memcpy(out, line, len);
+                memcpy(out, line->text, len);
                 out += len;
             }
             *out++ = '\n';
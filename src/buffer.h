@@ -1,25 +1,88 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 
+// A line is a span of bytes. Unedited lines borrow their bytes from the
+// buffer's original file contents (cap == 0); a line is copied into its own
+// heap block of cap bytes the first time it is modified. Line text is not
+// NUL-terminated.
 typedef struct {
-    char **lines;
+    char *text;
+    int len;
+    int cap;
+} BufferLine;
+
+// One change in the coordinates of the text before it was applied, the
+// same shape as an LSP content change. The text is lines joined by '\n'.
+typedef struct {
+    int start_row;
+    int start_col;
+    int end_row;
+    int end_col;
+    char *text;
+    int text_len;
+} BufferEdit;
+
+// Lines are kept in a gap array: the unused slots sit at the last edit
+// position, so inserting or deleting lines near the cursor does not shift
+// the rest of the file.
+typedef struct {
+    BufferLine *lines;
     int line_count;
     int line_capacity;
+    int gap_start;
+
+    // File contents the unedited lines point into. This is a heap copy
+    // unless the file reached the size set with buffer_set_map_threshold(),
+    // in which case it is a read-only mapping of the file. A mapping is not
+    // a snapshot: unedited lines follow changes other programs make to the
+    // file, and pages past a truncated end are replaced with zeros by the
+    // SIGBUS guard, which sets original_lost. A mapped buffer can only be
+    // reloaded once the file changes on disk.
+    char *original;
+    size_t original_size;
+    bool original_mapped;
+    volatile sig_atomic_t original_lost;
+
+    // Edits since the last buffer_reset_edits(). edits_valid is false when
+    // the log no longer describes every change (never reset, file reloaded,
+    // log overflowed), in which case consumers must resend the whole text.
+    BufferEdit *edits;
+    int edit_count;
+    int edit_capacity;
+    bool edits_valid;
 } TextBuffer;
 
+// Files of at least this many bytes are mapped instead of read into the
+// heap; 0, the default, never maps
+void buffer_set_map_threshold(size_t bytes);
+
 TextBuffer *buffer_create(void);
 void buffer_free(TextBuffer *buffer);
 bool buffer_load_from_file(TextBuffer *buffer, const char *filename);
 bool buffer_save_to_file(TextBuffer *buffer, const char *filename);
+const char *buffer_get_line(const TextBuffer *buffer, int row);
+int buffer_line_length(const TextBuffer *buffer, int row);
 void buffer_insert_char(TextBuffer *buffer, int row, int col, char c);
 void buffer_delete_char(TextBuffer *buffer, int row, int col);
 void buffer_insert_newline(TextBuffer *buffer, int row, int col);
 void buffer_insert_line(TextBuffer *buffer, int row, const char *text);
+void buffer_insert_text(TextBuffer *buffer, int row, int col, const char *text, int len,
+                        int *end_row, int *end_col);
 void buffer_delete_line(TextBuffer *buffer, int row);
+void buffer_delete_range(TextBuffer *buffer, int start_row, int start_col, int end_row, int end_col);
 void buffer_merge_lines(TextBuffer *buffer, int row);
+void buffer_reset_edits(TextBuffer *buffer);
+
+// Move the original text off the file mapping, e.g. before we overwrite the
+// file: truncating it would otherwise pull the pages out from under the
+// borrowed lines. The copy holds whatever the file contains now, so after
+// another program changed the file the unedited lines no longer match what
+// was loaded.
+bool buffer_detach_original(TextBuffer *buffer);
 char *buffer_get_text_range(TextBuffer *buffer, int start_row, int start_col, int end_row, int end_col);
 
-#endif
\ No newline at end of file
+#endif
@@ -24,6 +24,13 @@ typedef struct {
     SemanticTokenType type;
 } StoredToken;
 
+// Forward-only walk over the tokens of one line, for left-to-right scans
+typedef struct {
+    const StoredToken *tokens;
+    int pos;
+    int end;
+} TokenCursor;
+
 // Code folding
 typedef struct {
     int start_line;     // Line that remains visible (0-based)
@@ -31,6 +38,30 @@ typedef struct {
     bool is_folded;     // Currently collapsed
 } Fold;
 
+// Open fold candidate on the detection stack: the line it starts on and the
+// brace depth, indent or heading level it was opened at
+typedef struct {
+    int line;
+    int key;
+} FoldStackEntry;
+
+// Fold detection state at the start of a line, saved periodically so an
+// edit only needs to rescan from the nearest checkpoint before it
+typedef struct {
+    int line;
+    FoldStackEntry *stack;
+    int depth;
+    bool in_code_block;
+} FoldCheckpoint;
+
+// Run of lines hidden by collapsed folds. Overlapping and adjacent folds are
+// merged, so the ranges are disjoint and sorted.
+typedef struct {
+    int first;          // First hidden line
+    int last;           // Last hidden line (inclusive)
+    int hidden_before;  // Hidden lines in all earlier ranges
+} FoldHiddenRange;
+
 // FoldStyle is defined in editor_config.h as ConfigFoldStyle
 
 typedef struct {
@@ -62,9 +93,14 @@ typedef struct {
     LineDiagnostic *diagnostics;
     int diagnostic_count;
     int diagnostic_capacity;
+    int *diagnostic_line_start;  // Diagnostics are grouped by line
+    int *diagnostic_line_count;
+    int diagnostic_line_capacity;
     bool lsp_opened;  // Whether we've sent didOpen to LSP
     int lsp_version;
     char *lsp_name;
+    bool lsp_change_pending;  // Edits not yet sent in a didChange
+    long long lsp_last_sync_ms;
 
     // Semantic tokens for syntax highlighting
     StoredToken *tokens;
@@ -77,9 +113,18 @@ typedef struct {
     long long tokens_last_change_ms;
 
     // Code folding
-    Fold *folds;
+    Fold *folds;        // Sorted by start_line, one fold per start line
     int fold_count;
     int fold_capacity;
+    FoldCheckpoint *fold_checkpoints;
+    int fold_checkpoint_count;
+    int fold_checkpoint_capacity;
+    FoldHiddenRange *fold_hidden;   // Rebuilt lazily when fold_index_dirty
+    int fold_hidden_count;
+    int fold_hidden_capacity;
+    int *fold_max_end;              // Largest end_line among folds[0..i]
+    int fold_max_end_capacity;
+    bool fold_index_dirty;
     ConfigFoldStyle fold_style;
 } Tab;
 
@@ -177,6 +222,8 @@ Tab* get_current_tab(void);
 DiagnosticSeverity get_line_diagnostic_severity(Tab *tab, int line);
 const char *get_line_diagnostic_message(Tab *tab, int line);
 const char *get_token_color(SemanticTokenType type);
+void token_cursor_init(TokenCursor *cursor, Tab *tab, int line);
+const StoredToken *token_cursor_next(TokenCursor *cursor, int col);
 Fold *get_fold_at_line(Tab *tab, int line);
 Fold *get_fold_containing_line(Tab *tab, int line);
 bool is_line_visible(Tab *tab, int line);
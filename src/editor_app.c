@@ -134,6 +134,7 @@ int editor_run(int argc, char *argv[]) {
     editor.file_manager_focused = false;
 
     editor_config_load();
+    buffer_set_map_threshold(editor_config_get_map_threshold_bytes());
 
     editor.lsp_enabled = false;
 
@@ -177,6 +178,8 @@ int editor_run(int argc, char *argv[]) {
         process_resize();
         scroll_if_needed();
         hover_process_requests();
+        process_lsp_changes();
+        lsp_process_timeouts();
         process_semantic_tokens_requests();
         if (editor.hover_request_active &&
             (monotonic_ms() - editor.hover_request_ms > 1000)) {
@@ -196,25 +199,22 @@ int editor_run(int argc, char *argv[]) {
         }
         
         fd_set readfds;
+        fd_set writefds;
         struct timeval timeout;
         FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
         FD_SET(STDIN_FILENO, &readfds);
 
-        int lsp_fd = lsp_get_fd();
-        int max_fd = STDIN_FILENO;
-        if (lsp_fd >= 0) {
-            FD_SET(lsp_fd, &readfds);
-            if (lsp_fd > max_fd) max_fd = lsp_fd;
-        }
+        // Queued LSP output goes out as each server makes room for it
+        int max_fd = lsp_add_fds(&readfds, &writefds, STDIN_FILENO);
 
         long remaining_ms = frame_remaining_ms(&last_frame, 16);
         timeout.tv_sec = remaining_ms / 1000;
         timeout.tv_usec = (remaining_ms % 1000) * 1000;
 
-        int activity = select(max_fd + 1, &readfds, NULL, NULL, &timeout);
+        int activity = select(max_fd + 1, &readfds, &writefds, NULL, &timeout);
 
-        if (activity > 0 && lsp_fd >= 0 && FD_ISSET(lsp_fd, &readfds)) {
-            lsp_process_incoming();
+        if (activity > 0 && lsp_process_fds(&readfds, &writefds)) {
             pending_draw = true;
         }
 
@@ -252,13 +252,31 @@ int editor_run(int argc, char *argv[]) {
             }
         
         } else if (editor.reload_confirmation_active) {
-            if (c == 'r' || c == 'R') {
+            // A mapped buffer reads the changed file through its unedited
+            // lines, so keeping it as it was loaded is not possible. Without
+            // edits it is simply reloaded; with edits the user has to pick
+            // between reloading and keeping the edited lines.
+            Tab* tab = &editor.tabs[editor.reload_tab_index];
+            bool mapped = tab->buffer->original_mapped;
+            if (c == 'r' || c == 'R' || (mapped && !tab->modified)) {
                 reload_file_in_tab(editor.reload_tab_index);
                 editor.reload_confirmation_active = false;
                 pending_draw = true;
+            } else if (mapped && c != 'k' && c != 'K') {
+                // Wait for an explicit choice
+            } else if (mapped) {
+                buffer_detach_original(tab->buffer);
+                if (tab->filename) {
+                    tab->file_mtime = get_file_mtime(tab->filename);
+                }
+                editor.reload_confirmation_active = false;
+                editor.needs_full_redraw = true;
+                set_status_message(tab->buffer->original_lost
+                                   ? "Kept edited lines; the rest of the file was truncated, saving is disabled"
+                                   : "Kept edited lines; unedited lines show the file's new contents");
+                pending_draw = true;
             } else {
-                Tab* tab = &editor.tabs[editor.reload_tab_index];
-                if (tab && tab->filename) {
+                if (tab->filename) {
                     tab->file_mtime = get_file_mtime(tab->filename);
                 }
                 editor.reload_confirmation_active = false;
@@ -428,13 +446,7 @@ int editor_run(int argc, char *argv[]) {
                 if (tab && tab->selecting) {
                     delete_selection();
                 }
-                for (char *p = clipboard; *p; p++) {
-                    if (*p == '\n') {
-                        insert_newline();
-                    } else {
-                        insert_char(*p);
-                    }
-                }
+                insert_text(clipboard);
                 free(clipboard);
                 set_status_message("Pasted from clipboard");
             }
@@ -445,8 +457,7 @@ int editor_run(int argc, char *argv[]) {
                 tab->select_start_x = 0;
                 tab->select_start_y = 0;
                 tab->select_end_y = tab->buffer->line_count - 1;
-                tab->select_end_x = tab->buffer->lines[tab->select_end_y] ? 
-                                     strlen(tab->buffer->lines[tab->select_end_y]) : 0;
+                tab->select_end_x = buffer_line_length(tab->buffer, tab->select_end_y);
                 tab->selecting = true;
                 editor.needs_full_redraw = true;
                 set_status_message("Selected all text");
@@ -458,7 +469,7 @@ int editor_run(int argc, char *argv[]) {
                 set_status_message("Hover: no file");
             } else if (!editor.lsp_enabled || !tab->lsp_opened) {
                 set_status_message("Hover: LSP not active");
-            } else if (!lsp_hover_is_supported()) {
+            } else if (!lsp_hover_is_supported(tab->filename)) {
                 set_status_message("Hover: not supported by LSP");
             } else {
                 if (editor.hover_active) {
@@ -610,8 +621,7 @@ int editor_run(int argc, char *argv[]) {
             Tab* tab = get_current_tab();
             if (tab) {
                 clear_selection();
-                int line_len = tab->buffer->lines[tab->cursor_y] ? 
-                              strlen(tab->buffer->lines[tab->cursor_y]) : 0;
+                int line_len = buffer_line_length(tab->buffer, tab->cursor_y);
                 tab->cursor_x = line_len;
             }
         } else if (c == MOUSE_SCROLL_UP) {
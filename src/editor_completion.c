@@ -3,6 +3,7 @@
 #include "editor_folds.h"
 #include "editor_tabs.h"
 #include "lsp.h"
+#include "lsp_integration.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,9 +61,9 @@ static bool is_word_char_local(char c) {
 static char *completion_prefix_at(Tab *tab, int line, int col) {
     if (!tab || !tab->buffer) return NULL;
     if (line < 0 || line >= tab->buffer->line_count) return NULL;
-    char *text = tab->buffer->lines[line];
+    const char *text = buffer_get_line(tab->buffer, line);
     if (!text) return NULL;
-    int len = (int)strlen(text);
+    int len = buffer_line_length(tab->buffer, line);
     int idx = col - 1;
     if (idx < 0 || idx >= len) return NULL;
     if (!is_word_char_local(text[idx])) return NULL;
@@ -83,9 +84,9 @@ bool completion_has_member_context(Tab *tab) {
     int line = tab->cursor_y;
     int col = tab->cursor_x;
     if (line < 0 || line >= tab->buffer->line_count) return false;
-    char *text = tab->buffer->lines[line];
+    const char *text = buffer_get_line(tab->buffer, line);
     if (!text) return false;
-    int len = (int)strlen(text);
+    int len = buffer_line_length(tab->buffer, line);
     int idx = col - 1;
     if (idx < 0 || idx >= len) return false;
 
@@ -128,7 +129,7 @@ void completion_clear(void) {
 
 void completion_request_at_cursor(Tab *tab, const char *trigger, int trigger_kind, bool keep_items) {
     if (!tab || !tab->filename || !tab->lsp_opened) return;
-    if (!editor.lsp_enabled || !lsp_completion_is_supported()) return;
+    if (!editor.lsp_enabled || !lsp_completion_is_supported(tab->filename)) return;
 
     if (!keep_items) {
         completion_clear();
@@ -145,6 +146,7 @@ void completion_request_at_cursor(Tab *tab, const char *trigger, int trigger_kin
     editor.completion_request_ms = monotonic_ms();
     editor.completion_request_active = true;
 
+    flush_lsp_changes(tab);
     lsp_request_completion(tab->filename, tab->cursor_y, tab->cursor_x, trigger, trigger_kind);
 }
 
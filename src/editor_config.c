@@ -11,6 +11,10 @@ static LanguageConfig *configs = NULL;
 static int config_count = 0;
 static int config_capacity = 0;
 
+#define DEFAULT_LSP_CHANGE_DELAY_MS 200
+static int lsp_change_delay_ms = DEFAULT_LSP_CHANGE_DELAY_MS;
+static size_t map_threshold_bytes = 0;
+
 // Parse fold style string
 static ConfigFoldStyle parse_fold_style(const char *str) {
     if (!str) return FOLD_STYLE_NONE;
@@ -123,6 +127,20 @@ static bool load_from_path(const char *path) {
         return false;
     }
 
+    // Get didChange debounce interval (optional)
+    JsonValue *change_delay = json_object_get(root, "lsp_change_delay_ms");
+    if (change_delay && change_delay->type == JSON_NUMBER) {
+        int delay = (int)json_get_number(change_delay);
+        lsp_change_delay_ms = delay < 0 ? 0 : delay;
+    }
+
+    // Get large-file mapping threshold (optional, off unless set)
+    JsonValue *map_threshold = json_object_get(root, "mmap_file_size_mb");
+    if (map_threshold && map_threshold->type == JSON_NUMBER) {
+        double mb = json_get_number(map_threshold);
+        map_threshold_bytes = mb > 0 ? (size_t)(mb * 1024 * 1024) : 0;
+    }
+
     // Iterate over language entries
     for (int i = 0; i < languages->data.object.count; i++) {
         add_config(languages->data.object.pairs[i].key,
@@ -251,6 +269,8 @@ void editor_config_free(void) {
     configs = NULL;
     config_count = 0;
     config_capacity = 0;
+    lsp_change_delay_ms = DEFAULT_LSP_CHANGE_DELAY_MS;
+    map_threshold_bytes = 0;
 }
 
 LanguageConfig *editor_config_get_for_extension(const char *extension) {
@@ -294,3 +314,11 @@ LanguageConfig *editor_config_get_all(int *count) {
     if (count) *count = config_count;
     return configs;
 }
+
+int editor_config_get_lsp_change_delay_ms(void) {
+    return lsp_change_delay_ms;
+}
+
+size_t editor_config_get_map_threshold_bytes(void) {
+    return map_threshold_bytes;
+}
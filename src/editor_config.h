@@ -2,6 +2,7 @@
 #define EDITOR_CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Fold styles
 typedef enum {
@@ -42,4 +43,10 @@ ConfigFoldStyle editor_config_get_fold_style(const char *filename);
 // Get all loaded configs
 LanguageConfig *editor_config_get_all(int *count);
 
+// Minimum time between didChange notifications for one file
+int editor_config_get_lsp_change_delay_ms(void);
+
+// Size from which files are mmap'd instead of read; 0 when mapping is off
+size_t editor_config_get_map_threshold_bytes(void);
+
 #endif
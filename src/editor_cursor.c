@@ -14,8 +14,7 @@ void move_cursor(int dx, int dy) {
             int prev_line = get_prev_visible_line(tab, tab->cursor_y);
             if (prev_line != tab->cursor_y) {
                 tab->cursor_y = prev_line;
-                char *line = tab->buffer->lines[tab->cursor_y];
-                tab->cursor_x = line ? strlen(line) : 0;
+                tab->cursor_x = buffer_line_length(tab->buffer, tab->cursor_y);
             }
             editor.needs_full_redraw = true;
         }
@@ -23,8 +22,7 @@ void move_cursor(int dx, int dy) {
     }
 
     if (dy == 0 && dx > 0) {
-        char *line = tab->buffer->lines[tab->cursor_y];
-        int line_len = line ? strlen(line) : 0;
+        int line_len = buffer_line_length(tab->buffer, tab->cursor_y);
         if (tab->cursor_x >= line_len) {
             if (tab->cursor_y < tab->buffer->line_count - 1) {
                 int next_line = get_next_visible_line(tab, tab->cursor_y);
@@ -60,8 +58,7 @@ void move_cursor(int dx, int dy) {
         }
     }
     
-    int line_len = tab->buffer->lines[tab->cursor_y] ? 
-                   strlen(tab->buffer->lines[tab->cursor_y]) : 0;
+    int line_len = buffer_line_length(tab->buffer, tab->cursor_y);
     if (tab->cursor_x > line_len) tab->cursor_x = line_len;
     if (tab->cursor_x < 0) tab->cursor_x = 0;
     
@@ -138,10 +135,10 @@ void move_cursor_word_right(void) {
     Tab* tab = get_current_tab();
     if (!tab || tab->cursor_y >= tab->buffer->line_count) return;
     
-    char *line = tab->buffer->lines[tab->cursor_y];
+    const char *line = buffer_get_line(tab->buffer, tab->cursor_y);
     if (!line) return;
     
-    int len = strlen(line);
+    int len = buffer_line_length(tab->buffer, tab->cursor_y);
     
     if (tab->cursor_x >= len) {
         if (tab->cursor_y < tab->buffer->line_count - 1) {
@@ -149,9 +146,9 @@ void move_cursor_word_right(void) {
             if (next_line == tab->cursor_y) return;
             tab->cursor_y = next_line;
             tab->cursor_x = 0;
-            line = tab->buffer->lines[tab->cursor_y];
+            line = buffer_get_line(tab->buffer, tab->cursor_y);
             if (line) {
-                len = strlen(line);
+                len = buffer_line_length(tab->buffer, tab->cursor_y);
                 while (tab->cursor_x < len && !is_word_char(line[tab->cursor_x])) {
                     tab->cursor_x++;
                 }
@@ -181,7 +178,7 @@ void move_cursor_word_left(void) {
     Tab* tab = get_current_tab();
     if (!tab) return;
     
-    char *line = tab->buffer->lines[tab->cursor_y];
+    const char *line = buffer_get_line(tab->buffer, tab->cursor_y);
     if (!line) return;
     
     if (tab->cursor_x == 0) {
@@ -189,8 +186,7 @@ void move_cursor_word_left(void) {
             int prev_line = get_prev_visible_line(tab, tab->cursor_y);
             if (prev_line == tab->cursor_y) return;
             tab->cursor_y = prev_line;
-            line = tab->buffer->lines[tab->cursor_y];
-            tab->cursor_x = line ? strlen(line) : 0;
+            tab->cursor_x = buffer_line_length(tab->buffer, tab->cursor_y);
         }
         return;
     }
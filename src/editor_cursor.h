@@ -1,6 +1,8 @@
 #ifndef EDITOR_CURSOR_H
 #define EDITOR_CURSOR_H
 
+#include <stdbool.h>
+
 void move_cursor(int dx, int dy);
 void scroll_if_needed(void);
 void auto_scroll_during_selection(int screen_y);
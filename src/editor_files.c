@@ -109,6 +109,7 @@ void save_file(void) {
                 tab->filename = strdup(filename);
             }
         }
+        render_invalidate();
         editor.needs_full_redraw = true;
     }
     
@@ -118,7 +119,6 @@ void save_file(void) {
         tab->file_mtime = get_file_mtime(tab->filename);
         set_status_message("File saved: %s", tab->filename);
 
-        detect_folds(tab);
         // Request updated semantic tokens for syntax highlighting
         request_semantic_tokens(tab);
     } else {
@@ -136,7 +136,9 @@ void insert_char(char c) {
 
     // Notify LSP of the change
     notify_lsp_file_changed(tab);
-    detect_folds(tab);
+    shift_lsp_annotations(tab, tab->cursor_y, tab->cursor_x - 1, tab->cursor_y, tab->cursor_x - 1,
+                          tab->cursor_y, tab->cursor_x);
+    update_folds(tab, tab->cursor_y, tab->cursor_y, tab->cursor_y);
 
     if (c == '.') {
         completion_request_at_cursor(tab, ".", 2, false);
@@ -170,7 +172,9 @@ void delete_char(void) {
 
         // Notify LSP of the change
         notify_lsp_file_changed(tab);
-        detect_folds(tab);
+        shift_lsp_annotations(tab, tab->cursor_y, tab->cursor_x, tab->cursor_y, tab->cursor_x + 1,
+                              tab->cursor_y, tab->cursor_x);
+        update_folds(tab, tab->cursor_y, tab->cursor_y, tab->cursor_y);
 
         if (editor.completion_active || editor.completion_request_active ||
             completion_has_member_context(tab)) {
@@ -186,8 +190,7 @@ void delete_char(void) {
         }
         draw_line(tab->cursor_y - tab->offset_y, tab->cursor_y, text_start_col);
     } else if (tab->cursor_y > 0) {
-        int prev_line_len = tab->buffer->lines[tab->cursor_y - 1] ?
-                           strlen(tab->buffer->lines[tab->cursor_y - 1]) : 0;
+        int prev_line_len = buffer_line_length(tab->buffer, tab->cursor_y - 1);
         buffer_merge_lines(tab->buffer, tab->cursor_y - 1);
         tab->cursor_y--;
         tab->cursor_x = prev_line_len;
@@ -195,7 +198,9 @@ void delete_char(void) {
 
         // Notify LSP of the change
         notify_lsp_file_changed(tab);
-        detect_folds(tab);
+        shift_lsp_annotations(tab, tab->cursor_y, tab->cursor_x, tab->cursor_y + 1, 0,
+                              tab->cursor_y, tab->cursor_x);
+        update_folds(tab, tab->cursor_y, tab->cursor_y + 1, tab->cursor_y);
 
         if (editor.completion_active || editor.completion_request_active ||
             completion_has_member_context(tab)) {
@@ -212,6 +217,7 @@ void insert_newline(void) {
     Tab* tab = get_current_tab();
     if (!tab) return;
 
+    int start_x = tab->cursor_x;
     buffer_insert_newline(tab->buffer, tab->cursor_y, tab->cursor_x);
     tab->cursor_y++;
     tab->cursor_x = 0;
@@ -219,7 +225,31 @@ void insert_newline(void) {
 
     // Notify LSP of the change
     notify_lsp_file_changed(tab);
-    detect_folds(tab);
+    shift_lsp_annotations(tab, tab->cursor_y - 1, start_x, tab->cursor_y - 1, start_x,
+                          tab->cursor_y, 0);
+    update_folds(tab, tab->cursor_y - 1, tab->cursor_y - 1, tab->cursor_y);
+
+    editor.needs_full_redraw = true;
+}
+
+// Insert a block of text (e.g. a paste) as a single edit
+void insert_text(const char *text) {
+    Tab* tab = get_current_tab();
+    if (!tab || !text || text[0] == '\0') return;
+
+    int start_y = tab->cursor_y;
+    int start_x = tab->cursor_x;
+    buffer_insert_text(tab->buffer, tab->cursor_y, tab->cursor_x, text, strlen(text),
+                       &tab->cursor_y, &tab->cursor_x);
+    tab->modified = true;
+
+    notify_lsp_file_changed(tab);
+    shift_lsp_annotations(tab, start_y, start_x, start_y, start_x, tab->cursor_y, tab->cursor_x);
+    update_folds(tab, start_y, start_y, tab->cursor_y);
+
+    if (editor.completion_active) {
+        completion_clear();
+    }
 
     editor.needs_full_redraw = true;
 }
@@ -254,6 +284,13 @@ void check_file_changes(void) {
         Tab* tab = &editor.tabs[i];
         if (!tab->filename) continue;
         
+        // A truncation seen through the file mapping counts as a change
+        // even when it happened within the mtime's resolution
+        if (tab->buffer->original_mapped && tab->buffer->original_lost) {
+            show_reload_confirmation(i);
+            return;
+        }
+
         time_t current_mtime = get_file_mtime(tab->filename);
         if (current_mtime > tab->file_mtime && !tab->modified) {
             show_reload_confirmation(i);
@@ -291,6 +328,7 @@ void reload_file_in_tab(int tab_index) {
         tab->modified = false;
         tab->file_mtime = get_file_mtime(tab->filename);
         set_status_message("File reloaded: %s", tab->filename);
+        detect_folds(tab);
         editor.needs_full_redraw = true;
     } else {
         set_status_message("Error: Could not reload file %s", tab->filename);
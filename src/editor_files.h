@@ -8,6 +8,7 @@ void save_file(void);
 void insert_char(char c);
 void delete_char(void);
 void insert_newline(void);
+void insert_text(const char *text);
 
 void enter_filename_input_mode(void);
 void exit_filename_input_mode(void);
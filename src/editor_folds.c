@@ -4,273 +4,621 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define FOLD_CHECKPOINT_LINES 256
+#define MAX_BRACE_DEPTH 1024
+#define MAX_INDENT_DEPTH 1024
+#define MAX_HEADING_DEPTH 128
+
+typedef struct {
+    Fold *items;
+    int count;
+    int capacity;
+} FoldList;
+
+typedef struct {
+    FoldStackEntry *stack;
+    int depth;
+    int capacity;
+    bool in_code_block;
+} FoldScanState;
+
+static void clear_fold_checkpoints(Tab *tab) {
+    for (int i = 0; i < tab->fold_checkpoint_count; i++) {
+        free(tab->fold_checkpoints[i].stack);
+    }
+    free(tab->fold_checkpoints);
+    tab->fold_checkpoints = NULL;
+    tab->fold_checkpoint_count = 0;
+    tab->fold_checkpoint_capacity = 0;
+}
+
 void clear_tab_folds(Tab *tab) {
     if (!tab) return;
     free(tab->folds);
     tab->folds = NULL;
     tab->fold_count = 0;
     tab->fold_capacity = 0;
+    clear_fold_checkpoints(tab);
+    free(tab->fold_hidden);
+    tab->fold_hidden = NULL;
+    tab->fold_hidden_count = 0;
+    tab->fold_hidden_capacity = 0;
+    free(tab->fold_max_end);
+    tab->fold_max_end = NULL;
+    tab->fold_max_end_capacity = 0;
+    tab->fold_index_dirty = true;
 }
 
-void add_fold(Tab *tab, int start_line, int end_line) {
-    if (!tab || start_line >= end_line) return;
-
-    for (int i = 0; i < tab->fold_count; i++) {
-        if (tab->folds[i].start_line == start_line) return;
-    }
-
-    if (tab->fold_count >= tab->fold_capacity) {
-        int new_capacity = tab->fold_capacity == 0 ? 16 : tab->fold_capacity * 2;
-        Fold *new_folds = realloc(tab->folds, new_capacity * sizeof(Fold));
-        if (!new_folds) return;
-        tab->folds = new_folds;
-        tab->fold_capacity = new_capacity;
+static void fold_list_append(FoldList *list, const Fold *fold) {
+    if (list->count >= list->capacity) {
+        int new_capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        Fold *new_items = realloc(list->items, new_capacity * sizeof(Fold));
+        if (!new_items) return;
+        list->items = new_items;
+        list->capacity = new_capacity;
     }
-
-    tab->folds[tab->fold_count].start_line = start_line;
-    tab->folds[tab->fold_count].end_line = end_line;
-    tab->folds[tab->fold_count].is_folded = false;
-    tab->fold_count++;
+    list->items[list->count++] = *fold;
 }
 
-void detect_folds_braces(Tab *tab) {
-    if (!tab || !tab->buffer) return;
+static void fold_list_add(FoldList *list, int start_line, int end_line) {
+    if (start_line >= end_line) return;
 
-    int stack[1024];
-    int stack_size = 0;
+    Fold fold = { start_line, end_line, false };
+    fold_list_append(list, &fold);
+}
 
-    for (int i = 0; i < tab->buffer->line_count; i++) {
-        char *line = tab->buffer->lines[i];
-        if (!line) continue;
+static bool scan_push(FoldScanState *st, int line, int key, int limit) {
+    if (st->depth >= limit) return false;
+    if (st->depth >= st->capacity) {
+        int new_capacity = st->capacity == 0 ? 16 : st->capacity * 2;
+        FoldStackEntry *new_stack = realloc(st->stack, new_capacity * sizeof(FoldStackEntry));
+        if (!new_stack) return false;
+        st->stack = new_stack;
+        st->capacity = new_capacity;
+    }
+    st->stack[st->depth].line = line;
+    st->stack[st->depth].key = key;
+    st->depth++;
+    return true;
+}
 
-        for (char *p = line; *p; p++) {
-            if (*p == '{') {
-                if (stack_size < (int)(sizeof(stack) / sizeof(stack[0]))) {
-                    stack[stack_size++] = i;
-                }
-            } else if (*p == '}') {
-                if (stack_size > 0) {
-                    int start = stack[--stack_size];
-                    if (i > start) {
-                        add_fold(tab, start, i);
-                    }
+static void scan_line_braces(FoldScanState *st, FoldList *out, int i, const char *line, int len) {
+    for (const char *p = line; p < line + len; p++) {
+        if (*p == '{') {
+            scan_push(st, i, 0, MAX_BRACE_DEPTH);
+        } else if (*p == '}') {
+            if (st->depth > 0) {
+                int start = st->stack[--st->depth].line;
+                if (i > start) {
+                    fold_list_add(out, start, i);
                 }
             }
         }
     }
 }
 
-static int get_line_indent(const char *line) {
+static int get_line_indent(const char *line, int len) {
     int indent = 0;
-    while (line && *line) {
-        if (*line == ' ') indent++;
-        else if (*line == '\t') indent += 4;
+    int i = 0;
+    while (line && i < len) {
+        if (line[i] == ' ') indent++;
+        else if (line[i] == '\t') indent += 4;
         else break;
-        line++;
+        i++;
     }
     return indent;
 }
 
-void detect_folds_indent(Tab *tab) {
-    if (!tab || !tab->buffer) return;
+static void scan_line_indent(FoldScanState *st, FoldList *out, int i, const char *line, int len) {
+    int indent = get_line_indent(line, len);
+    if (len == 0) return;
+
+    while (st->depth > 0 && indent <= st->stack[st->depth - 1].key) {
+        int start = st->stack[--st->depth].line;
+        if (i - 1 > start) {
+            fold_list_add(out, start, i - 1);
+        }
+    }
+
+    scan_push(st, i, indent, MAX_INDENT_DEPTH);
+}
+
+static int get_heading_level(const char *line, int len) {
+    if (!line || len == 0 || line[0] != '#') return 0;
+    int level = 0;
+    while (level < len && line[level] == '#') {
+        level++;
+    }
+    return level;
+}
 
-    int stack_line[1024];
-    int stack_indent[1024];
-    int stack_size = 0;
+static bool is_code_fence(const char *line, int len) {
+    if (!line || len < 3) return false;
+    return (memcmp(line, "```", 3) == 0 || memcmp(line, "~~~", 3) == 0);
+}
 
-    for (int i = 0; i < tab->buffer->line_count; i++) {
-        char *line = tab->buffer->lines[i];
-        if (!line) continue;
+static void scan_line_headings(FoldScanState *st, FoldList *out, int i, const char *line, int len) {
+    if (is_code_fence(line, len)) {
+        st->in_code_block = !st->in_code_block;
+        return;
+    }
+    if (st->in_code_block) return;
 
-        int indent = get_line_indent(line);
-        if (*line == '\0') continue;
+    int level = get_heading_level(line, len);
+    if (level == 0) return;
 
-        while (stack_size > 0 && indent <= stack_indent[stack_size - 1]) {
-            int start = stack_line[--stack_size];
-            if (i - 1 > start) {
-                add_fold(tab, start, i - 1);
-            }
+    while (st->depth > 0 && level <= st->stack[st->depth - 1].key) {
+        int start = st->stack[--st->depth].line;
+        if (i - 1 > start) {
+            fold_list_add(out, start, i - 1);
         }
+    }
 
-        if (stack_size < (int)(sizeof(stack_line) / sizeof(stack_line[0]))) {
-            stack_line[stack_size] = i;
-            stack_indent[stack_size] = indent;
-            stack_size++;
-        }
+    scan_push(st, i, level, MAX_HEADING_DEPTH);
+}
+
+static void scan_line(Tab *tab, FoldScanState *st, FoldList *out, int i) {
+    const char *line = buffer_get_line(tab->buffer, i);
+    if (!line) return;
+    int len = buffer_line_length(tab->buffer, i);
+
+    if (tab->fold_style == FOLD_STYLE_BRACES) {
+        scan_line_braces(st, out, i, line, len);
+    } else if (tab->fold_style == FOLD_STYLE_INDENT) {
+        scan_line_indent(st, out, i, line, len);
+    } else if (tab->fold_style == FOLD_STYLE_HEADINGS) {
+        scan_line_headings(st, out, i, line, len);
     }
+}
 
-    while (stack_size > 0) {
-        int start = stack_line[--stack_size];
-        int end = tab->buffer->line_count - 1;
+// Close whatever is still open at the end of the file
+static void scan_finish(Tab *tab, FoldScanState *st, FoldList *out) {
+    if (tab->fold_style == FOLD_STYLE_BRACES) return;
+
+    int end = tab->buffer->line_count - 1;
+    while (st->depth > 0) {
+        int start = st->stack[--st->depth].line;
         if (end > start) {
-            add_fold(tab, start, end);
+            fold_list_add(out, start, end);
         }
     }
 }
 
-static int get_heading_level(const char *line) {
-    if (!line || line[0] != '#') return 0;
-    int level = 0;
-    while (*line == '#') {
-        level++;
-        line++;
-    }
-    return level;
+// The line whose scan produces a fold: braces close on their last line,
+// indent and heading folds close when the next block starts
+static int fold_closing_line(Tab *tab, const Fold *fold) {
+    return tab->fold_style == FOLD_STYLE_BRACES ? fold->end_line : fold->end_line + 1;
 }
 
-static bool is_code_fence(const char *line) {
-    if (!line) return false;
-    return (strncmp(line, "```", 3) == 0 || strncmp(line, "~~~", 3) == 0);
+static bool checkpoint_push(FoldCheckpoint **list, int *count, int *capacity,
+                            int line, const FoldScanState *st) {
+    if (*count >= *capacity) {
+        int new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        FoldCheckpoint *new_list = realloc(*list, new_capacity * sizeof(FoldCheckpoint));
+        if (!new_list) return false;
+        *list = new_list;
+        *capacity = new_capacity;
+    }
+
+    FoldCheckpoint *cp = &(*list)[*count];
+    cp->line = line;
+    cp->depth = st->depth;
+    cp->in_code_block = st->in_code_block;
+    cp->stack = NULL;
+    if (st->depth > 0) {
+        cp->stack = malloc(st->depth * sizeof(FoldStackEntry));
+        if (!cp->stack) return false;
+        memcpy(cp->stack, st->stack, st->depth * sizeof(FoldStackEntry));
+    }
+    (*count)++;
+    return true;
 }
 
-void detect_folds_headings(Tab *tab) {
-    if (!tab || !tab->buffer) return;
+static int compare_folds(const void *a, const void *b) {
+    const Fold *fa = a;
+    const Fold *fb = b;
+    if (fa->start_line != fb->start_line) return fa->start_line - fb->start_line;
+    return fa->end_line - fb->end_line;
+}
 
-    int stack_line[128];
-    int stack_level[128];
-    int stack_size = 0;
-    bool in_code_block = false;
+static Fold *find_fold_by_start(Fold *folds, int count, int start_line) {
+    int lo = 0;
+    int hi = count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (folds[mid].start_line == start_line) return &folds[mid];
+        if (folds[mid].start_line < start_line) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
 
-    for (int i = 0; i < tab->buffer->line_count; i++) {
-        char *line = tab->buffer->lines[i];
-        if (!line) continue;
+// Carry over collapsed state from the current folds that started on the
+// same line before the edit
+static void restore_fold_state(Tab *tab, Fold *folds, int count, int edit_start, int old_end, int delta) {
+    for (int i = 0; i < count; i++) {
+        int old_start = folds[i].start_line;
+        if (old_start > old_end + delta) {
+            old_start -= delta;
+        } else if (old_start >= edit_start && old_start > old_end) {
+            continue;
+        }
+        Fold *old = find_fold_by_start(tab->folds, tab->fold_count, old_start);
+        if (old && old->is_folded) folds[i].is_folded = true;
+    }
+}
 
-        if (is_code_fence(line)) {
-            in_code_block = !in_code_block;
+// Install a sorted list, keeping one fold per start line (the innermost,
+// as the scan produces it first)
+static void install_folds(Tab *tab, FoldList *list) {
+    Fold *out = list->items;
+    int out_count = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (out_count > 0 && out[out_count - 1].start_line == list->items[i].start_line) {
             continue;
         }
-        if (in_code_block) continue;
+        out[out_count++] = list->items[i];
+    }
+
+    free(tab->folds);
+    tab->folds = out;
+    tab->fold_count = out_count;
+    tab->fold_capacity = list->capacity;
+    tab->fold_index_dirty = true;
+}
 
-        int level = get_heading_level(line);
-        if (level == 0) continue;
+void detect_folds(Tab *tab) {
+    if (!tab || !tab->buffer) return;
 
-        while (stack_size > 0 && level <= stack_level[stack_size - 1]) {
-            int start = stack_line[--stack_size];
-            if (i - 1 > start) {
-                add_fold(tab, start, i - 1);
+    FoldList list = {0};
+    FoldScanState st = {0};
+    FoldCheckpoint *cps = NULL;
+    int cp_count = 0;
+    int cp_capacity = 0;
+
+    if (tab->fold_style != FOLD_STYLE_NONE) {
+        for (int i = 0; i < tab->buffer->line_count; i++) {
+            if (i % FOLD_CHECKPOINT_LINES == 0) {
+                checkpoint_push(&cps, &cp_count, &cp_capacity, i, &st);
             }
+            scan_line(tab, &st, &list, i);
+        }
+        scan_finish(tab, &st, &list);
+    }
+    free(st.stack);
+
+    if (list.count > 0) qsort(list.items, list.count, sizeof(Fold), compare_folds);
+    restore_fold_state(tab, list.items, list.count, 0, tab->buffer->line_count - 1, 0);
+    install_folds(tab, &list);
+
+    clear_fold_checkpoints(tab);
+    tab->fold_checkpoints = cps;
+    tab->fold_checkpoint_count = cp_count;
+    tab->fold_checkpoint_capacity = cp_capacity;
+}
+
+static int map_line(int line, int edit_start, int old_end, int delta) {
+    if (line < edit_start || line <= old_end) return line;
+    return line + delta;
+}
+
+static bool checkpoint_matches(const FoldCheckpoint *cp, const FoldScanState *st,
+                               int edit_start, int old_end, int delta) {
+    if (cp->depth != st->depth || cp->in_code_block != st->in_code_block) return false;
+    for (int i = 0; i < cp->depth; i++) {
+        if (cp->stack[i].key != st->stack[i].key) return false;
+        // A fold opened on an edited line would close at a shifted distance
+        if (delta != 0 && cp->stack[i].line >= edit_start && cp->stack[i].line <= old_end) {
+            return false;
         }
+        if (map_line(cp->stack[i].line, edit_start, old_end, delta) != st->stack[i].line) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Lines edit_start..old_end were replaced by edit_start..new_end. Rescan from
+// the last checkpoint at or before the edit until the detection state matches
+// a checkpoint taken after the edited lines; folds and checkpoints beyond that
+// point are only shifted.
+void update_folds(Tab *tab, int edit_start, int old_end, int new_end) {
+    if (!tab || !tab->buffer) return;
+    if (tab->fold_style == FOLD_STYLE_NONE) return;
+    if (tab->fold_checkpoint_count == 0 || edit_start < 0) {
+        detect_folds(tab);
+        return;
+    }
 
-        if (stack_size < (int)(sizeof(stack_line) / sizeof(stack_line[0]))) {
-            stack_line[stack_size] = i;
-            stack_level[stack_size] = level;
-            stack_size++;
+    int delta = new_end - old_end;
+    int line_count = tab->buffer->line_count;
+
+    // Restart from the last checkpoint that no edited line can affect
+    int restart = 0;
+    for (int lo = 0, hi = tab->fold_checkpoint_count - 1; lo <= hi;) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->fold_checkpoints[mid].line <= edit_start) {
+            restart = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
     }
+    FoldCheckpoint *start_cp = &tab->fold_checkpoints[restart];
+    int scan_from = start_cp->line;
 
-    while (stack_size > 0) {
-        int start = stack_line[--stack_size];
-        int end = tab->buffer->line_count - 1;
-        if (end > start) {
-            add_fold(tab, start, end);
+    FoldScanState st = {0};
+    for (int i = 0; i < start_cp->depth; i++) {
+        scan_push(&st, start_cp->stack[i].line, start_cp->stack[i].key, start_cp->depth);
+    }
+    st.in_code_block = start_cp->in_code_block;
+
+    FoldList fresh = {0};
+    FoldCheckpoint *new_cps = NULL;
+    int new_cp_count = 0;
+    int new_cp_capacity = 0;
+
+    int next_old = restart + 1;
+    int converged = -1;   // index of the old checkpoint the scan caught up with
+    int last_cp_line = scan_from;
+    int i = scan_from;
+    for (; i < line_count; i++) {
+        bool at_old_cp = false;
+        if (i > new_end) {
+            while (next_old < tab->fold_checkpoint_count &&
+                   (tab->fold_checkpoints[next_old].line <= old_end ||
+                    tab->fold_checkpoints[next_old].line + delta < i)) {
+                next_old++;
+            }
+            if (next_old < tab->fold_checkpoint_count &&
+                tab->fold_checkpoints[next_old].line + delta == i) {
+                if (checkpoint_matches(&tab->fold_checkpoints[next_old], &st, edit_start, old_end, delta)) {
+                    converged = next_old;
+                    break;
+                }
+                at_old_cp = true;
+            }
+        }
+        // Replace old checkpoints passed on the way so spacing stays even
+        if (i > scan_from && (i - last_cp_line >= FOLD_CHECKPOINT_LINES ||
+                              (at_old_cp && i - last_cp_line >= FOLD_CHECKPOINT_LINES / 4))) {
+            checkpoint_push(&new_cps, &new_cp_count, &new_cp_capacity, i, &st);
+            last_cp_line = i;
+        }
+        scan_line(tab, &st, &fresh, i);
+    }
+    if (converged < 0) {
+        scan_finish(tab, &st, &fresh);
+    }
+    free(st.stack);
+
+    // Checkpoints up to the restart point stay, the ones taken during the
+    // rescan are added and the ones after convergence only move by delta
+    int kept_after = converged < 0 ? 0 : tab->fold_checkpoint_count - converged;
+    int total = restart + 1 + new_cp_count + kept_after;
+    FoldCheckpoint *cps = malloc(total * sizeof(FoldCheckpoint));
+    if (!cps) {
+        for (int k = 0; k < new_cp_count; k++) free(new_cps[k].stack);
+        free(new_cps);
+        free(fresh.items);
+        detect_folds(tab);
+        return;
+    }
+    int old_resume = converged >= 0 ? tab->fold_checkpoints[converged].line : -1;
+    memcpy(cps, tab->fold_checkpoints, (restart + 1) * sizeof(FoldCheckpoint));
+    int cp_count = restart + 1;
+    for (int k = 0; k < new_cp_count; k++) {
+        cps[cp_count++] = new_cps[k];
+    }
+    free(new_cps);
+    for (int k = restart + 1; k < tab->fold_checkpoint_count; k++) {
+        FoldCheckpoint *cp = &tab->fold_checkpoints[k];
+        // Deletions pull checkpoints together; thin them out as they close up
+        if (converged < 0 || k < converged ||
+            cp->line + delta - cps[cp_count - 1].line < FOLD_CHECKPOINT_LINES / 4) {
+            free(cp->stack);
+            continue;
         }
+        cp->line += delta;
+        for (int d = 0; d < cp->depth; d++) {
+            cp->stack[d].line = map_line(cp->stack[d].line, edit_start, old_end, delta);
+        }
+        cps[cp_count++] = *cp;
+    }
+    free(tab->fold_checkpoints);
+    tab->fold_checkpoints = cps;
+    tab->fold_checkpoint_count = cp_count;
+    tab->fold_checkpoint_capacity = total;
+
+    // Old folds produced before the restart point are unchanged and those
+    // produced after the convergence point only move by delta. The shift
+    // keeps them in order, so they are merged with the rescanned folds.
+    if (fresh.count > 0) qsort(fresh.items, fresh.count, sizeof(Fold), compare_folds);
+    restore_fold_state(tab, fresh.items, fresh.count, edit_start, old_end, delta);
+
+    FoldList merged = {0};
+    int f = 0;
+    for (int k = 0; k < tab->fold_count; k++) {
+        Fold fold = tab->folds[k];
+        int closing = fold_closing_line(tab, &fold);
+        if (closing >= scan_from && (old_resume < 0 || closing < old_resume)) continue;
+        int new_closing = map_line(closing, edit_start, old_end, delta);
+        fold.start_line = map_line(fold.start_line, edit_start, old_end, delta);
+        fold.end_line = new_closing - (closing - fold.end_line);
+        while (f < fresh.count && compare_folds(&fresh.items[f], &fold) < 0) {
+            fold_list_append(&merged, &fresh.items[f++]);
+        }
+        fold_list_append(&merged, &fold);
+    }
+    while (f < fresh.count) {
+        fold_list_append(&merged, &fresh.items[f++]);
     }
+    free(fresh.items);
+    install_folds(tab, &merged);
 }
 
-void detect_folds(Tab *tab) {
-    if (!tab) return;
-    clear_tab_folds(tab);
+// Rebuild the query index: the running max of fold ends (for containment
+// lookups) and the merged ranges hidden by collapsed folds with a prefix sum
+// of hidden lines (for visibility and display line mapping)
+static bool ensure_fold_index(Tab *tab) {
+    if (!tab->fold_index_dirty) return true;
+
+    if (tab->fold_count > tab->fold_max_end_capacity) {
+        int *new_max = realloc(tab->fold_max_end, tab->fold_capacity * sizeof(int));
+        if (!new_max) return false;
+        tab->fold_max_end = new_max;
+        tab->fold_max_end_capacity = tab->fold_capacity;
+    }
+
+    tab->fold_hidden_count = 0;
+    int max_end = -1;
+    int hidden = 0;
+    for (int i = 0; i < tab->fold_count; i++) {
+        Fold *fold = &tab->folds[i];
+        if (fold->end_line > max_end) max_end = fold->end_line;
+        tab->fold_max_end[i] = max_end;
+
+        // A fold hides the lines strictly between its start and end
+        int first = fold->start_line + 1;
+        int last = fold->end_line - 1;
+        if (!fold->is_folded || first > last) continue;
+
+        if (tab->fold_hidden_count > 0) {
+            FoldHiddenRange *prev = &tab->fold_hidden[tab->fold_hidden_count - 1];
+            if (first <= prev->last + 1) {
+                if (last > prev->last) {
+                    hidden += last - prev->last;
+                    prev->last = last;
+                }
+                continue;
+            }
+        }
 
-    ConfigFoldStyle style = tab->fold_style;
-    if (style == FOLD_STYLE_BRACES) {
-        detect_folds_braces(tab);
-    } else if (style == FOLD_STYLE_INDENT) {
-        detect_folds_indent(tab);
-    } else if (style == FOLD_STYLE_HEADINGS) {
-        detect_folds_headings(tab);
+        if (tab->fold_hidden_count >= tab->fold_hidden_capacity) {
+            int new_capacity = tab->fold_hidden_capacity == 0 ? 16 : tab->fold_hidden_capacity * 2;
+            FoldHiddenRange *new_ranges = realloc(tab->fold_hidden, new_capacity * sizeof(FoldHiddenRange));
+            if (!new_ranges) return false;
+            tab->fold_hidden = new_ranges;
+            tab->fold_hidden_capacity = new_capacity;
+        }
+        FoldHiddenRange *range = &tab->fold_hidden[tab->fold_hidden_count++];
+        range->first = first;
+        range->last = last;
+        range->hidden_before = hidden;
+        hidden += last - first + 1;
     }
+
+    tab->fold_index_dirty = false;
+    return true;
 }
 
-Fold *get_fold_at_line(Tab *tab, int line) {
-    if (!tab) return NULL;
-    for (int i = 0; i < tab->fold_count; i++) {
-        if (tab->folds[i].start_line == line) {
-            return &tab->folds[i];
+// Index of the last hidden range starting at or before line, or -1
+static int find_hidden_range(Tab *tab, int line) {
+    int found = -1;
+    int lo = 0;
+    int hi = tab->fold_hidden_count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->fold_hidden[mid].first <= line) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
     }
-    return NULL;
+    return found;
 }
 
-Fold *get_fold_containing_line(Tab *tab, int line) {
+Fold *get_fold_at_line(Tab *tab, int line) {
     if (!tab) return NULL;
-    for (int i = 0; i < tab->fold_count; i++) {
-        if (line > tab->folds[i].start_line && line < tab->folds[i].end_line) {
-            return &tab->folds[i];
-        }
+    return find_fold_by_start(tab->folds, tab->fold_count, line);
+}
+
+// Returns the outermost fold containing line
+Fold *get_fold_containing_line(Tab *tab, int line) {
+    if (!tab || !ensure_fold_index(tab)) return NULL;
+
+    // First fold whose running max end passes line: every earlier fold ends
+    // at or before it and every later one starts no earlier
+    int lo = 0;
+    int hi = tab->fold_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->fold_max_end[mid] > line) hi = mid;
+        else lo = mid + 1;
+    }
+    if (lo < tab->fold_count && tab->folds[lo].start_line < line) {
+        return &tab->folds[lo];
     }
     return NULL;
 }
 
 bool is_line_visible(Tab *tab, int line) {
-    if (!tab) return true;
-    for (int i = 0; i < tab->fold_count; i++) {
-        if (!tab->folds[i].is_folded) continue;
-        if (line > tab->folds[i].start_line && line < tab->folds[i].end_line) {
-            return false;
-        }
-    }
-    return true;
+    if (!tab || !ensure_fold_index(tab)) return true;
+    int r = find_hidden_range(tab, line);
+    return r < 0 || line > tab->fold_hidden[r].last;
 }
 
 int get_next_visible_line(Tab *tab, int line) {
-    if (!tab) return line;
-    for (int i = line + 1; i < tab->buffer->line_count; i++) {
-        if (is_line_visible(tab, i)) return i;
+    if (!tab || !ensure_fold_index(tab)) return line;
+    int next = line + 1;
+    int r = find_hidden_range(tab, next);
+    if (r >= 0 && next <= tab->fold_hidden[r].last) {
+        next = tab->fold_hidden[r].last + 1;
     }
-    return line;
+    return next < tab->buffer->line_count ? next : line;
 }
 
 int get_prev_visible_line(Tab *tab, int line) {
-    if (!tab) return line;
-    for (int i = line - 1; i >= 0; i--) {
-        if (is_line_visible(tab, i)) return i;
+    if (!tab || !ensure_fold_index(tab)) return line;
+    int prev = line - 1;
+    int r = find_hidden_range(tab, prev);
+    if (r >= 0 && prev <= tab->fold_hidden[r].last) {
+        prev = tab->fold_hidden[r].first - 1;
     }
-    return line;
+    return prev >= 0 ? prev : line;
 }
 
 void toggle_fold_at_line(Tab *tab, int line) {
     Fold *fold = get_fold_at_line(tab, line);
     if (!fold) return;
     fold->is_folded = !fold->is_folded;
+    tab->fold_index_dirty = true;
     editor.needs_full_redraw = true;
 }
 
-int count_folded_lines_before(Tab *tab, int line) {
-    if (!tab) return 0;
-    int count = 0;
-    for (int i = 0; i < tab->fold_count; i++) {
-        if (tab->folds[i].is_folded && tab->folds[i].start_line < line) {
-            if (tab->folds[i].end_line < line) {
-                count += tab->folds[i].end_line - tab->folds[i].start_line - 1;
-            } else {
-                count += line - tab->folds[i].start_line - 1;
-            }
-        }
-    }
-    return count;
+static int count_folded_lines_before(Tab *tab, int line) {
+    int r = find_hidden_range(tab, line - 1);
+    if (r < 0) return 0;
+    const FoldHiddenRange *range = &tab->fold_hidden[r];
+    int last = range->last < line ? range->last : line - 1;
+    return range->hidden_before + last - range->first + 1;
 }
 
 int file_line_to_display_line(Tab *tab, int file_line) {
-    if (!tab) return file_line;
+    if (!tab || !ensure_fold_index(tab)) return file_line;
     return file_line - count_folded_lines_before(tab, file_line);
 }
 
 int display_line_to_file_line(Tab *tab, int display_line) {
-    if (!tab) return display_line;
-
-    int file_line = 0;
-    int current_display = 0;
-
-    while (current_display < display_line && file_line < tab->buffer->line_count) {
-        if (is_line_visible(tab, file_line)) {
-            current_display++;
-        }
-        file_line++;
+    if (!tab || !ensure_fold_index(tab)) return display_line;
+
+    // The visible line just before hidden range k has display line
+    // first - hidden_before - 1, which grows strictly with k. Every range
+    // whose start maps at or below display_line lies before the answer.
+    int lo = 0;
+    int hi = tab->fold_hidden_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->fold_hidden[mid].first - tab->fold_hidden[mid].hidden_before <= display_line) lo = mid + 1;
+        else hi = mid;
     }
-
-    while (file_line < tab->buffer->line_count && !is_line_visible(tab, file_line)) {
-        file_line++;
+    int hidden = 0;
+    if (lo > 0) {
+        const FoldHiddenRange *range = &tab->fold_hidden[lo - 1];
+        hidden = range->hidden_before + range->last - range->first + 1;
     }
 
-    return file_line;
+    int file_line = display_line + hidden;
+    return file_line < tab->buffer->line_count ? file_line : tab->buffer->line_count;
 }
@@ -5,6 +5,7 @@
 
 void clear_tab_folds(Tab *tab);
 void detect_folds(Tab *tab);
+void update_folds(Tab *tab, int edit_start, int old_end, int new_end);
 Fold *get_fold_at_line(Tab *tab, int line);
 Fold *get_fold_containing_line(Tab *tab, int line);
 bool is_line_visible(Tab *tab, int line);
@@ -4,6 +4,7 @@
 #include "buffer.h"
 #include "editor_folds.h"
 #include "lsp.h"
+#include "lsp_integration.h"
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
@@ -203,9 +204,9 @@ static char *build_struct_fields(TextBuffer *buffer, const char *struct_name, in
     if (start_line >= buffer->line_count) start_line = 0;
 
     for (int i = start_line; i < buffer->line_count; i++) {
-        const char *src_line = buffer->lines[i];
+        const char *src_line = buffer_get_line(buffer, i);
         if (!src_line) continue;
-        char *line = strdup(src_line);
+        char *line = strndup(src_line, buffer_line_length(buffer, i));
         if (!line) continue;
 
         if (!in_struct) {
@@ -518,6 +519,7 @@ void hover_process_requests(void) {
     editor.hover_request_col = editor.hover_target_col;
     editor.hover_request_ms = monotonic_ms();
     editor.hover_request_active = true;
+    flush_lsp_changes(tab);
     lsp_request_hover(tab->filename, editor.hover_request_line, editor.hover_request_col);
 }
 
@@ -534,6 +536,7 @@ void hover_request_cursor(Tab *tab) {
     editor.hover_request_col = tab->cursor_x;
     editor.hover_request_ms = monotonic_ms();
     editor.hover_request_active = true;
+    flush_lsp_changes(tab);
     lsp_request_hover(tab->filename, tab->cursor_y, tab->cursor_x);
 }
 
@@ -586,7 +589,7 @@ void lsp_hover_handler(const char *uri, int line, int col, const char *text) {
 
     char struct_name[128];
     if (parse_struct_type_name(editor.hover_text, struct_name, sizeof(struct_name)) &&
-        lsp_type_definition_is_supported() && tab_idx == editor.current_tab) {
+        lsp_type_definition_is_supported(editor.tabs[tab_idx].filename) && tab_idx == editor.current_tab) {
         editor.hover_type_struct_name = strdup(struct_name);
         if (editor.hover_type_struct_name) {
             editor.hover_type_base_text = strdup(editor.hover_text);
@@ -595,6 +598,7 @@ void lsp_hover_handler(const char *uri, int line, int col, const char *text) {
                 editor.hover_type_request_col = col;
                 editor.hover_type_request_active = true;
                 Tab *tab = &editor.tabs[tab_idx];
+                flush_lsp_changes(tab);
                 lsp_request_type_definition(tab->filename, line, col);
             }
         }
@@ -50,10 +50,10 @@ static void get_word_bounds_at(Tab *tab, int line, int col, int *out_start, int
     *out_end = col;
     if (!tab || !tab->buffer || line < 0 || line >= tab->buffer->line_count) return;
 
-    char *text = tab->buffer->lines[line];
+    const char *text = buffer_get_line(tab->buffer, line);
     if (!text) return;
 
-    int len = (int)strlen(text);
+    int len = buffer_line_length(tab->buffer, line);
     if (len == 0) return;
 
     int idx = col;
@@ -125,8 +125,7 @@ void handle_mouse(int button, int x, int y, int pressed) {
             return;
         }
 
-        int line_len = tab->buffer->lines[buffer_y] ?
-                       strlen(tab->buffer->lines[buffer_y]) : 0;
+        int line_len = buffer_line_length(tab->buffer, buffer_y);
         if (buffer_x < 0) buffer_x = 0;
         if (buffer_x >= line_len) {
             hover_show_diagnostic(buffer_y, x, y);
@@ -239,8 +238,7 @@ void handle_mouse(int button, int x, int y, int pressed) {
             }
             if (buffer_y < 0) buffer_y = 0;
             
-            int line_len = tab->buffer->lines[buffer_y] ? 
-                           strlen(tab->buffer->lines[buffer_y]) : 0;
+            int line_len = buffer_line_length(tab->buffer, buffer_y);
             if (buffer_x > line_len) buffer_x = line_len;
             if (buffer_x < 0) buffer_x = 0;
             
@@ -298,8 +296,7 @@ void handle_mouse(int button, int x, int y, int pressed) {
             }
             if (buffer_y < 0) buffer_y = 0;
             
-            int line_len = tab->buffer->lines[buffer_y] ? 
-                           strlen(tab->buffer->lines[buffer_y]) : 0;
+            int line_len = buffer_line_length(tab->buffer, buffer_y);
             if (buffer_x > line_len) buffer_x = line_len;
             if (buffer_x < 0) buffer_x = 0;
             
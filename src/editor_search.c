@@ -39,11 +39,13 @@ int find_matches(void) {
     bool found_current = false;
     
     for (int y = 0; y < tab->buffer->line_count; y++) {
-        char *line = tab->buffer->lines[y];
+        const char *line = buffer_get_line(tab->buffer, y);
         if (!line) continue;
+        const char *end = line + buffer_line_length(tab->buffer, y);
         
-        char *pos = line;
-        while ((pos = strstr(pos, editor.search_query)) != NULL) {
+        const char *pos = line;
+        while ((pos = memmem(pos, end - pos, editor.search_query,
+                             editor.search_query_len)) != NULL) {
             matches++;
             int x = pos - line;
             
@@ -68,11 +70,13 @@ void jump_to_match(int match_num) {
     
     int found = 0;
     for (int y = 0; y < tab->buffer->line_count; y++) {
-        char *line = tab->buffer->lines[y];
+        const char *line = buffer_get_line(tab->buffer, y);
         if (!line) continue;
+        const char *end = line + buffer_line_length(tab->buffer, y);
         
-        char *pos = line;
-        while ((pos = strstr(pos, editor.search_query)) != NULL) {
+        const char *pos = line;
+        while ((pos = memmem(pos, end - pos, editor.search_query,
+                             editor.search_query_len)) != NULL) {
             found++;
             if (found == match_num) {
                 int x = pos - line;
@@ -56,47 +56,8 @@ void delete_selection(void) {
         end_x = temp_x; end_y = temp_y;
     }
 
-    if (start_y != end_y && end_x == 0) {
-        end_y--;
-        if (end_y < start_y) {
-            end_y = start_y;
-            end_x = start_x;
-        } else {
-            end_x = tab->buffer->lines[end_y] ? strlen(tab->buffer->lines[end_y]) : 0;
-        }
-    }
-    
-    if (start_y == end_y) {
-        for (int x = end_x - 1; x >= start_x; x--) {
-            if (x < (int)strlen(tab->buffer->lines[start_y])) {
-                buffer_delete_char(tab->buffer, start_y, x);
-            }
-        }
-    } else {
-        for (int x = end_x - 1; x >= 0; x--) {
-            if (x < (int)strlen(tab->buffer->lines[end_y])) {
-                buffer_delete_char(tab->buffer, end_y, x);
-            }
-        }
-        
-        for (int y = end_y; y > start_y; y--) {
-            if (y < tab->buffer->line_count) {
-                buffer_delete_line(tab->buffer, y);
-            }
-        }
-        
-        if (start_y < tab->buffer->line_count && tab->buffer->lines[start_y]) {
-            int line_len = strlen(tab->buffer->lines[start_y]);
-            for (int x = line_len - 1; x >= start_x; x--) {
-                buffer_delete_char(tab->buffer, start_y, x);
-            }
-        }
-        
-        if (start_y < tab->buffer->line_count - 1) {
-            buffer_merge_lines(tab->buffer, start_y);
-        }
-    }
-    
+    buffer_delete_range(tab->buffer, start_y, start_x, end_y, end_x);
+
     tab->cursor_x = start_x;
     tab->cursor_y = start_y;
 
@@ -104,7 +65,8 @@ void delete_selection(void) {
     tab->modified = true;
 
     notify_lsp_file_changed(tab);
-    detect_folds(tab);
+    shift_lsp_annotations(tab, start_y, start_x, end_y, end_x, start_y, start_x);
+    update_folds(tab, start_y, end_y, start_y);
 
     editor.needs_full_redraw = true;
 }
@@ -124,61 +86,5 @@ char *get_selected_text(void) {
         end_x = temp_x; end_y = temp_y;
     }
     
-    int total_len = 0;
-    
-    if (start_y == end_y) {
-        total_len = end_x - start_x;
-    } else {
-        if (tab->buffer->lines[start_y]) {
-            total_len += strlen(tab->buffer->lines[start_y]) - start_x;
-        }
-        total_len++;
-        
-        for (int y = start_y + 1; y < end_y; y++) {
-            if (tab->buffer->lines[y]) {
-                total_len += strlen(tab->buffer->lines[y]);
-            }
-            total_len++;
-        }
-        
-        if (tab->buffer->lines[end_y]) {
-            total_len += end_x;
-        }
-    }
-    
-    char *selected = malloc(total_len + 1);
-    if (!selected) return NULL;
-    
-    int pos = 0;
-    
-    if (start_y == end_y) {
-        if (tab->buffer->lines[start_y]) {
-            memcpy(selected + pos, tab->buffer->lines[start_y] + start_x, end_x - start_x);
-            pos += end_x - start_x;
-        }
-    } else {
-        if (tab->buffer->lines[start_y]) {
-            int len = strlen(tab->buffer->lines[start_y]) - start_x;
-            memcpy(selected + pos, tab->buffer->lines[start_y] + start_x, len);
-            pos += len;
-        }
-        selected[pos++] = '\n';
-        
-        for (int y = start_y + 1; y < end_y; y++) {
-            if (tab->buffer->lines[y]) {
-                int len = strlen(tab->buffer->lines[y]);
-                memcpy(selected + pos, tab->buffer->lines[y], len);
-                pos += len;
-            }
-            selected[pos++] = '\n';
-        }
-        
-        if (tab->buffer->lines[end_y]) {
-            memcpy(selected + pos, tab->buffer->lines[end_y], end_x);
-            pos += end_x;
-        }
-    }
-    
-    selected[pos] = '\0';
-    return selected;
+    return buffer_get_text_range(tab->buffer, start_y, start_x, end_y, end_x);
 }
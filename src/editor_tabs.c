@@ -61,12 +61,26 @@ int create_new_tab(const char* filename) {
     tab->token_line_capacity = 0;
     tab->tokens_pending = false;
     tab->tokens_last_change_ms = 0;
+    tab->lsp_change_pending = false;
+    tab->lsp_last_sync_ms = 0;
     tab->diagnostics = NULL;
     tab->diagnostic_count = 0;
     tab->diagnostic_capacity = 0;
+    tab->diagnostic_line_start = NULL;
+    tab->diagnostic_line_count = NULL;
+    tab->diagnostic_line_capacity = 0;
     tab->folds = NULL;
     tab->fold_count = 0;
     tab->fold_capacity = 0;
+    tab->fold_checkpoints = NULL;
+    tab->fold_checkpoint_count = 0;
+    tab->fold_checkpoint_capacity = 0;
+    tab->fold_hidden = NULL;
+    tab->fold_hidden_count = 0;
+    tab->fold_hidden_capacity = 0;
+    tab->fold_max_end = NULL;
+    tab->fold_max_end_capacity = 0;
+    tab->fold_index_dirty = true;
     tab->fold_style = editor_config_get_fold_style(filename);
     
     detect_folds(tab);
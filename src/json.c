@@ -2,12 +2,136 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <ctype.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && !defined(JSON_NO_SIMD)
+#include <immintrin.h>
+#define JSON_SIMD_X86 1
+#endif
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_KEEP_MAX (1024 * 1024)    // Larger blocks are not kept across resets
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define OBJECT_INDEX_MIN 8                 // Smaller objects are scanned linearly
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    size_t last;        // Offset of the most recent allocation
+    char *data;
+} ArenaBlock;
+
+struct JsonArena {
+    ArenaBlock *blocks;     // Newest first
+};
+
+static JsonArena *current_arena = NULL;
+
+JsonArena *json_arena_create(void) {
+    return calloc(1, sizeof(JsonArena));
+}
+
+static void free_blocks(ArenaBlock *block) {
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+// Keep the newest (and largest) block for the next round unless it is huge
+void json_arena_reset(JsonArena *arena) {
+    if (!arena || !arena->blocks) return;
+    ArenaBlock *head = arena->blocks;
+    free_blocks(head->next);
+    head->next = NULL;
+    if (head->size > ARENA_KEEP_MAX) {
+        free(head);
+        arena->blocks = NULL;
+    } else {
+        head->used = 0;
+        head->last = 0;
+    }
+}
+
+void json_arena_free(JsonArena *arena) {
+    if (!arena) return;
+    if (current_arena == arena) current_arena = NULL;
+    free_blocks(arena->blocks);
+    free(arena);
+}
+
+JsonArena *json_use_arena(JsonArena *arena) {
+    JsonArena *prev = current_arena;
+    current_arena = arena;
+    return prev;
+}
+
+static void *arena_alloc(JsonArena *arena, size_t size) {
+    ArenaBlock *block = arena->blocks;
+    size_t offset = block ? (block->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1) : 0;
+    if (!block || offset + size > block->size) {
+        size_t block_size = block ? block->size * 2 : ARENA_BLOCK_SIZE;
+        if (block_size < size) block_size = size;
+        ArenaBlock *new_block = malloc(sizeof(ArenaBlock) + ARENA_ALIGN + block_size);
+        if (!new_block) return NULL;
+        uintptr_t data = (uintptr_t)(new_block + 1);
+        new_block->data = (char *)((data + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+        new_block->size = block_size;
+        new_block->next = block;
+        arena->blocks = new_block;
+        block = new_block;
+        offset = 0;
+    }
+    block->last = offset;
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+// Allocation helpers: from the arena when one is given, otherwise the heap
+
+static void *mem_alloc(JsonArena *arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+static void *mem_realloc(JsonArena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!arena) return realloc(ptr, new_size);
+
+    // The latest allocation can grow in place
+    ArenaBlock *block = arena->blocks;
+    if (ptr && block && (char *)ptr == block->data + block->last &&
+        block->last + new_size <= block->size) {
+        block->used = block->last + new_size;
+        return ptr;
+    }
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr && ptr) memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+static void mem_free(JsonArena *arena, void *ptr) {
+    if (!arena) free(ptr);
+}
+
+static char *mem_strndup(JsonArena *arena, const char *str, size_t len) {
+    char *copy = mem_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
 // Helper to create a new JsonValue
 static JsonValue *json_alloc(JsonType type) {
-    JsonValue *v = calloc(1, sizeof(JsonValue));
-    if (v) v->type = type;
+    JsonValue *v = mem_alloc(current_arena, sizeof(JsonValue));
+    if (v) {
+        memset(v, 0, sizeof(JsonValue));
+        v->type = type;
+        v->arena = current_arena;
+    }
     return v;
 }
 
@@ -30,7 +154,7 @@ JsonValue *json_number(double value) {
 JsonValue *json_string(const char *value) {
     JsonValue *v = json_alloc(JSON_STRING);
     if (v && value) {
-        v->data.string = strdup(value);
+        v->data.string = mem_strndup(v->arena, value, strlen(value));
     }
     return v;
 }
@@ -51,6 +175,8 @@ JsonValue *json_object(void) {
         v->data.object.pairs = NULL;
         v->data.object.count = 0;
         v->data.object.capacity = 0;
+        v->data.object.index = NULL;
+        v->data.object.index_size = 0;
     }
     return v;
 }
@@ -60,7 +186,9 @@ void json_array_push(JsonValue *arr, JsonValue *value) {
 
     if (arr->data.array.count >= arr->data.array.capacity) {
         int new_cap = arr->data.array.capacity == 0 ? 4 : arr->data.array.capacity * 2;
-        JsonValue **new_items = realloc(arr->data.array.items, new_cap * sizeof(JsonValue*));
+        JsonValue **new_items = mem_realloc(arr->arena, arr->data.array.items,
+                                            arr->data.array.capacity * sizeof(JsonValue*),
+                                            new_cap * sizeof(JsonValue*));
         if (!new_items) return;
         arr->data.array.items = new_items;
         arr->data.array.capacity = new_cap;
@@ -69,41 +197,120 @@ void json_array_push(JsonValue *arr, JsonValue *value) {
     arr->data.array.items[arr->data.array.count++] = value;
 }
 
-void json_object_set(JsonValue *obj, const char *key, JsonValue *value) {
-    if (!obj || obj->type != JSON_OBJECT || !key || !value) return;
+static uint32_t hash_key(const char *key) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
 
-    // Check if key exists
+static void index_insert(JsonValue *obj, int pos) {
+    int mask = obj->data.object.index_size - 1;
+    int slot = (int)(hash_key(obj->data.object.pairs[pos].key) & (uint32_t)mask);
+    while (obj->data.object.index[slot] >= 0) {
+        slot = (slot + 1) & mask;
+    }
+    obj->data.object.index[slot] = pos;
+}
+
+// (Re)build the hash index with room for twice the current keys
+static bool build_object_index(JsonValue *obj) {
+    int size = 16;
+    while (size < obj->data.object.count * 2) size *= 2;
+
+    int *index = mem_alloc(obj->arena, size * sizeof(int));
+    if (!index) return false;
+    mem_free(obj->arena, obj->data.object.index);
+    obj->data.object.index = index;
+    obj->data.object.index_size = size;
+    for (int i = 0; i < size; i++) index[i] = -1;
     for (int i = 0; i < obj->data.object.count; i++) {
-        if (strcmp(obj->data.object.pairs[i].key, key) == 0) {
-            json_free(obj->data.object.pairs[i].value);
-            obj->data.object.pairs[i].value = value;
-            return;
+        index_insert(obj, i);
+    }
+    return true;
+}
+
+// Position of key in the object's pairs, or -1
+static int object_find(JsonValue *obj, const char *key) {
+    if (!obj->data.object.index && obj->data.object.count >= OBJECT_INDEX_MIN) {
+        build_object_index(obj);
+    }
+
+    if (!obj->data.object.index) {
+        for (int i = 0; i < obj->data.object.count; i++) {
+            if (strcmp(obj->data.object.pairs[i].key, key) == 0) return i;
         }
+        return -1;
+    }
+
+    int mask = obj->data.object.index_size - 1;
+    int slot = (int)(hash_key(key) & (uint32_t)mask);
+    while (obj->data.object.index[slot] >= 0) {
+        int pos = obj->data.object.index[slot];
+        if (strcmp(obj->data.object.pairs[pos].key, key) == 0) return pos;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// Set key (allocated from the object's arena or the heap, and owned by the
+// object from here on) to value
+static void object_set_owned(JsonValue *obj, char *key, JsonValue *value) {
+    // Check if key exists
+    int existing = object_find(obj, key);
+    if (existing >= 0) {
+        json_free(obj->data.object.pairs[existing].value);
+        obj->data.object.pairs[existing].value = value;
+        mem_free(obj->arena, key);
+        return;
     }
 
     // Add new key
     if (obj->data.object.count >= obj->data.object.capacity) {
         int new_cap = obj->data.object.capacity == 0 ? 4 : obj->data.object.capacity * 2;
-        JsonKeyValue *new_pairs = realloc(obj->data.object.pairs, new_cap * sizeof(JsonKeyValue));
-        if (!new_pairs) return;
+        JsonKeyValue *new_pairs = mem_realloc(obj->arena, obj->data.object.pairs,
+                                              obj->data.object.capacity * sizeof(JsonKeyValue),
+                                              new_cap * sizeof(JsonKeyValue));
+        if (!new_pairs) {
+            mem_free(obj->arena, key);
+            return;
+        }
         obj->data.object.pairs = new_pairs;
         obj->data.object.capacity = new_cap;
     }
 
-    obj->data.object.pairs[obj->data.object.count].key = strdup(key);
+    obj->data.object.pairs[obj->data.object.count].key = key;
     obj->data.object.pairs[obj->data.object.count].value = value;
     obj->data.object.count++;
+
+    // Keep the index at most half full
+    if (obj->data.object.index) {
+        if (obj->data.object.count * 2 > obj->data.object.index_size) {
+            if (!build_object_index(obj)) {
+                mem_free(obj->arena, obj->data.object.index);
+                obj->data.object.index = NULL;
+                obj->data.object.index_size = 0;
+            }
+        } else {
+            index_insert(obj, obj->data.object.count - 1);
+        }
+    }
+}
+
+void json_object_set(JsonValue *obj, const char *key, JsonValue *value) {
+    if (!obj || obj->type != JSON_OBJECT || !key || !value) return;
+
+    char *owned = mem_strndup(obj->arena, key, strlen(key));
+    if (!owned) return;
+    object_set_owned(obj, owned, value);
 }
 
 JsonValue *json_object_get(JsonValue *obj, const char *key) {
     if (!obj || obj->type != JSON_OBJECT || !key) return NULL;
 
-    for (int i = 0; i < obj->data.object.count; i++) {
-        if (strcmp(obj->data.object.pairs[i].key, key) == 0) {
-            return obj->data.object.pairs[i].value;
-        }
-    }
-    return NULL;
+    int pos = object_find(obj, key);
+    return pos >= 0 ? obj->data.object.pairs[pos].value : NULL;
 }
 
 const char *json_get_string(JsonValue *v) {
@@ -133,7 +340,8 @@ JsonValue *json_array_get(JsonValue *v, int index) {
 }
 
 void json_free(JsonValue *v) {
-    if (!v) return;
+    // Arena values are released with their arena
+    if (!v || v->arena) return;
 
     switch (v->type) {
         case JSON_STRING:
@@ -151,6 +359,7 @@ void json_free(JsonValue *v) {
                 json_free(v->data.object.pairs[i].value);
             }
             free(v->data.object.pairs);
+            free(v->data.object.index);
             break;
         default:
             break;
@@ -158,6 +367,145 @@ void json_free(JsonValue *v) {
     free(v);
 }
 
+// Run scanning. Strings and whitespace are skipped a vector at a time where
+// the CPU allows; the scalar versions are the fallback and the reference.
+
+// Bytes that end an unescaped run inside a string: the quote, a backslash
+// and control characters, which include the terminating NUL
+static inline bool is_string_special(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20;
+}
+
+static inline bool is_json_space(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static size_t string_run_scalar(const char *s) {
+    const char *p = s;
+    while (!is_string_special((unsigned char)*p)) p++;
+    return (size_t)(p - s);
+}
+
+static size_t space_run_scalar(const char *s) {
+    const char *p = s;
+    while (is_json_space((unsigned char)*p)) p++;
+    return (size_t)(p - s);
+}
+
+#ifdef JSON_SIMD_X86
+// The vector scans only load aligned blocks, which never cross a page, so
+// reading past the terminating NUL cannot fault. Bytes of the first block
+// that lie before the start are masked off.
+
+__attribute__((no_sanitize_address))
+static size_t string_run_sse2(const char *s) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    unsigned skip = (unsigned)((uintptr_t)s & 15);
+    const char *block = s - skip;
+    unsigned live = 0xffffu << skip;
+    while (1) {
+        __m128i v = _mm_load_si128((const __m128i *)block);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit) & live;
+        if (mask) return (size_t)(block + __builtin_ctz(mask) - s);
+        block += 16;
+        live = 0xffffu;
+    }
+}
+
+__attribute__((no_sanitize_address))
+static size_t space_run_sse2(const char *s) {
+    unsigned skip = (unsigned)((uintptr_t)s & 15);
+    const char *block = s - skip;
+    unsigned live = 0xffffu << skip;
+    while (1) {
+        __m128i v = _mm_load_si128((const __m128i *)block);
+        __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(space) & live;
+        if (mask) return (size_t)(block + __builtin_ctz(mask) - s);
+        block += 16;
+        live = 0xffffu;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t string_run_avx2(const char *s) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+    unsigned skip = (unsigned)((uintptr_t)s & 31);
+    const char *block = s - skip;
+    unsigned live = 0xffffffffu << skip;
+    while (1) {
+        __m256i v = _mm256_load_si256((const __m256i *)block);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                      _mm256_cmpeq_epi8(v, backslash)),
+                                      _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit) & live;
+        if (mask) return (size_t)(block + __builtin_ctz(mask) - s);
+        block += 32;
+        live = 0xffffffffu;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t space_run_avx2(const char *s) {
+    unsigned skip = (unsigned)((uintptr_t)s & 31);
+    const char *block = s - skip;
+    unsigned live = 0xffffffffu << skip;
+    while (1) {
+        __m256i v = _mm256_load_si256((const __m256i *)block);
+        __m256i space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(space) & live;
+        if (mask) return (size_t)(block + __builtin_ctz(mask) - s);
+        block += 32;
+        live = 0xffffffffu;
+    }
+}
+#endif
+
+static size_t (*string_run_impl)(const char *) = NULL;
+static size_t (*space_run_impl)(const char *) = NULL;
+
+static void select_scanners(void) {
+    string_run_impl = string_run_scalar;
+    space_run_impl = space_run_scalar;
+#ifdef JSON_SIMD_X86
+    string_run_impl = string_run_sse2;
+    space_run_impl = space_run_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        string_run_impl = string_run_avx2;
+        space_run_impl = space_run_avx2;
+    }
+#endif
+}
+
+// Length of the unescaped run at s inside a string
+static inline size_t string_run(const char *s) {
+    if (is_string_special((unsigned char)*s)) return 0;
+    if (!string_run_impl) select_scanners();
+    return string_run_impl(s);
+}
+
+// Length of the JSON whitespace run at s. Compact JSON has at most a byte
+// or two between tokens, which is not worth a vector load.
+static inline size_t space_run(const char *s) {
+    if (!is_json_space((unsigned char)s[0])) return 0;
+    if (!is_json_space((unsigned char)s[1])) return 1;
+    if (!space_run_impl) select_scanners();
+    return space_run_impl(s);
+}
+
 // Parser state
 typedef struct {
     const char *str;
@@ -165,6 +513,7 @@ typedef struct {
 } Parser;
 
 static void skip_whitespace(Parser *p) {
+    p->pos += (int)space_run(p->str + p->pos);
     while (p->str[p->pos] && isspace((unsigned char)p->str[p->pos])) {
         p->pos++;
     }
@@ -178,12 +527,18 @@ static char *parse_string_content(Parser *p) {
 
     int start = p->pos;
     int len = 0;
+    bool escaped = false;
 
     // First pass: count length (handling escapes)
-    while (p->str[p->pos] && p->str[p->pos] != '"') {
+    while (1) {
+        size_t run = string_run(p->str + p->pos);
+        p->pos += (int)run;
+        len += (int)run;
+        if (!p->str[p->pos] || p->str[p->pos] == '"') break;
         if (p->str[p->pos] == '\\' && p->str[p->pos + 1]) {
             p->pos += 2;
             len++;
+            escaped = true;
         } else {
             p->pos++;
             len++;
@@ -191,13 +546,26 @@ static char *parse_string_content(Parser *p) {
     }
 
     // Allocate result
-    char *result = malloc(len + 1);
+    char *result = mem_alloc(current_arena, len + 1);
     if (!result) return NULL;
 
-    // Second pass: copy with escape handling
+    // Without escapes the text is the result
+    if (!escaped) {
+        memcpy(result, p->str + start, len);
+        result[len] = '\0';
+        if (p->str[p->pos] == '"') p->pos++; // skip closing quote
+        return result;
+    }
+
+    // Second pass: copy unescaped runs whole and decode escapes
     p->pos = start;
     int out = 0;
-    while (p->str[p->pos] && p->str[p->pos] != '"') {
+    while (1) {
+        size_t run = string_run(p->str + p->pos);
+        memcpy(result + out, p->str + p->pos, run);
+        out += (int)run;
+        p->pos += (int)run;
+        if (!p->str[p->pos] || p->str[p->pos] == '"') break;
         if (p->str[p->pos] == '\\' && p->str[p->pos + 1]) {
             p->pos++;
             switch (p->str[p->pos]) {
@@ -237,7 +605,7 @@ static JsonValue *parse_string(Parser *p) {
     if (v) {
         v->data.string = str;
     } else {
-        free(str);
+        mem_free(current_arena, str);
     }
     return v;
 }
@@ -260,9 +628,8 @@ static JsonValue *parse_number(Parser *p) {
         while (isdigit((unsigned char)p->str[p->pos])) p->pos++;
     }
 
-    char *numstr = strndup(p->str + start, p->pos - start);
-    double val = atof(numstr);
-    free(numstr);
+    // The scan above stops where strtod would, so parse in place
+    double val = strtod(p->str + start, NULL);
 
     return json_number(val);
 }
@@ -332,7 +699,7 @@ static JsonValue *parse_object(Parser *p) {
 
         skip_whitespace(p);
         if (p->str[p->pos] != ':') {
-            free(key);
+            mem_free(obj->arena, key);
             json_free(obj);
             return NULL;
         }
@@ -341,13 +708,12 @@ static JsonValue *parse_object(Parser *p) {
         skip_whitespace(p);
         JsonValue *value = parse_value(p);
         if (!value) {
-            free(key);
+            mem_free(obj->arena, key);
             json_free(obj);
             return NULL;
         }
 
-        json_object_set(obj, key, value);
-        free(key);
+        object_set_owned(obj, key, value);
 
         skip_whitespace(p);
         if (p->str[p->pos] == '}') {
@@ -398,45 +764,187 @@ JsonValue *json_parse(const char *str) {
     return parse_value(&p);
 }
 
+// Raw scanning
+
+static const char *scan_whitespace(const char *p) {
+    p += space_run(p);
+    while (*p && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+// p points at the opening quote; returns the position after the closing one
+static const char *scan_string(const char *p) {
+    p++;
+    while (1) {
+        p += string_run(p);
+        if (!*p || *p == '"') break;
+        if (*p == '\\' && p[1]) p++;
+        p++;
+    }
+    return *p == '"' ? p + 1 : NULL;
+}
+
+// Position after the value starting at p (leading whitespace allowed).
+// Containers are matched by bracket depth without validating their contents.
+const char *json_skip_value(const char *p) {
+    p = scan_whitespace(p);
+    if (*p == '"') return scan_string(p);
+
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (*p) {
+            char c = *p;
+            if (c == '"') {
+                p = scan_string(p);
+                if (!p) return NULL;
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) return p + 1;
+            }
+            p++;
+        }
+        return NULL;
+    }
+
+    // Number or literal
+    const char *start = p;
+    while (*p && *p != ',' && *p != ']' && *p != '}' && !isspace((unsigned char)*p)) p++;
+    return p > start ? p : NULL;
+}
+
+// Find several members of the object at obj in one pass. values[i] is set to
+// the start of the value for keys[i], or NULL when the key is absent. Keys
+// are compared as written, so they must not contain escapes.
+bool json_scan_members(const char *obj, const char **keys, const char **values, int count) {
+    for (int i = 0; i < count; i++) values[i] = NULL;
+
+    const char *p = scan_whitespace(obj);
+    if (*p != '{') return false;
+    p = scan_whitespace(p + 1);
+    if (*p == '}') return true;
+
+    while (1) {
+        if (*p != '"') return false;
+        const char *key = p + 1;
+        p = scan_string(p);
+        if (!p) return false;
+        size_t key_len = (size_t)(p - 1 - key);
+
+        p = scan_whitespace(p);
+        if (*p != ':') return false;
+        const char *value = scan_whitespace(p + 1);
+
+        for (int i = 0; i < count; i++) {
+            if (!values[i] && strncmp(keys[i], key, key_len) == 0 && keys[i][key_len] == '\0') {
+                values[i] = value;
+                break;
+            }
+        }
+
+        p = json_skip_value(value);
+        if (!p) return false;
+        p = scan_whitespace(p);
+        if (*p == '}') return true;
+        if (*p != ',') return false;
+        p = scan_whitespace(p + 1);
+    }
+}
+
+// Read an array of integers at p, appending to *items (grown as needed).
+// Returns the position after the array, or NULL if it holds anything but
+// integers.
+const char *json_scan_int_array(const char *p, int **items, int *count, int *capacity) {
+    p = scan_whitespace(p);
+    if (*p != '[') return NULL;
+    p = scan_whitespace(p + 1);
+    if (*p == ']') return p + 1;
+
+    while (1) {
+        bool negative = false;
+        if (*p == '-') {
+            negative = true;
+            p++;
+        }
+        if (!isdigit((unsigned char)*p)) return NULL;
+        long long value = 0;
+        while (isdigit((unsigned char)*p)) {
+            value = value * 10 + (*p - '0');
+            if (value > 2147483647LL) return NULL;
+            p++;
+        }
+
+        if (*count >= *capacity) {
+            int new_cap = *capacity == 0 ? 256 : *capacity * 2;
+            int *new_items = realloc(*items, new_cap * sizeof(int));
+            if (!new_items) return NULL;
+            *items = new_items;
+            *capacity = new_cap;
+        }
+        (*items)[(*count)++] = (int)(negative ? -value : value);
+
+        p = scan_whitespace(p);
+        if (*p == ']') return p + 1;
+        if (*p != ',') return NULL;
+        p = scan_whitespace(p + 1);
+    }
+}
+
 // Stringify helpers
 typedef struct {
     char *buf;
     int len;
     int capacity;
+    bool failed;
 } StringBuilder;
 
-static void sb_init(StringBuilder *sb) {
-    sb->capacity = 256;
-    sb->buf = malloc(sb->capacity);
-    sb->len = 0;
-    if (sb->buf) sb->buf[0] = '\0';
-}
-
-static void sb_append(StringBuilder *sb, const char *str) {
-    if (!sb->buf || !str) return;
-    int slen = strlen(str);
+static bool sb_reserve(StringBuilder *sb, int extra) {
+    if (sb->failed) return false;
+    if (sb->len + extra + 1 <= sb->capacity) return true;
 
-    while (sb->len + slen + 1 > sb->capacity) {
-        sb->capacity *= 2;
-        char *new_buf = realloc(sb->buf, sb->capacity);
-        if (!new_buf) return;
-        sb->buf = new_buf;
+    int new_cap = sb->capacity == 0 ? 256 : sb->capacity * 2;
+    while (sb->len + extra + 1 > new_cap) new_cap *= 2;
+    char *new_buf = realloc(sb->buf, new_cap);
+    if (!new_buf) {
+        sb->failed = true;
+        return false;
     }
+    sb->buf = new_buf;
+    sb->capacity = new_cap;
+    return true;
+}
 
-    memcpy(sb->buf + sb->len, str, slen + 1);
+static void sb_append_len(StringBuilder *sb, const char *str, int slen) {
+    if (!sb_reserve(sb, slen)) return;
+    memcpy(sb->buf + sb->len, str, slen);
     sb->len += slen;
+    sb->buf[sb->len] = '\0';
+}
+
+static void sb_append(StringBuilder *sb, const char *str) {
+    if (!str) return;
+    sb_append_len(sb, str, strlen(str));
 }
 
 static void sb_append_char(StringBuilder *sb, char c) {
-    char s[2] = {c, '\0'};
-    sb_append(sb, s);
+    if (!sb_reserve(sb, 1)) return;
+    sb->buf[sb->len++] = c;
+    sb->buf[sb->len] = '\0';
 }
 
 static void stringify_value(StringBuilder *sb, JsonValue *v);
 
 static void stringify_string(StringBuilder *sb, const char *str) {
     sb_append_char(sb, '"');
-    for (const char *p = str; *p; p++) {
+    for (const char *p = str; ; p++) {
+        // Copy the run up to the next character that needs escaping
+        size_t run = string_run(p);
+        sb_append_len(sb, p, (int)run);
+        p += run;
+        if (!*p) break;
+
         switch (*p) {
             case '"': sb_append(sb, "\\\""); break;
             case '\\': sb_append(sb, "\\\\"); break;
@@ -505,9 +1013,25 @@ static void stringify_value(StringBuilder *sb, JsonValue *v) {
     }
 }
 
+// Append the text of v to a growable buffer, e.g. one that is reused for
+// every message. *buf may start out NULL.
+bool json_stringify_append(JsonValue *v, char **buf, int *len, int *capacity) {
+    StringBuilder sb = { *buf, *len, *capacity, false };
+    stringify_value(&sb, v);
+    *buf = sb.buf;
+    *len = sb.len;
+    *capacity = sb.capacity;
+    return !sb.failed;
+}
+
 char *json_stringify(JsonValue *v) {
-    StringBuilder sb;
-    sb_init(&sb);
+    StringBuilder sb = { NULL, 0, 0, false };
+    if (!sb_reserve(&sb, 0)) return NULL;
+    sb.buf[0] = '\0';
     stringify_value(&sb, v);
+    if (sb.failed) {
+        free(sb.buf);
+        return NULL;
+    }
     return sb.buf;
 }
@@ -14,8 +14,9 @@ typedef enum {
     JSON_OBJECT
 } JsonType;
 
-// Forward declaration
+// Forward declarations
 typedef struct JsonValue JsonValue;
+typedef struct JsonArena JsonArena;
 
 // JSON object key-value pair
 typedef struct {
@@ -26,6 +27,7 @@ typedef struct {
 // JSON value structure
 struct JsonValue {
     JsonType type;
+    JsonArena *arena;   // Arena the value and its contents live in, or NULL
     union {
         bool boolean;
         double number;
@@ -39,10 +41,22 @@ struct JsonValue {
             JsonKeyValue *pairs;
             int count;
             int capacity;
+            int *index;         // Hash slots holding pair positions, -1 when empty;
+            int index_size;     // built lazily once the object has a few keys
         } object;
     } data;
 };
 
+// Arena allocation. While an arena is in use, new values and everything
+// they own (strings, keys, item arrays) are carved out of a few large
+// blocks. json_free ignores such values; resetting the arena releases all
+// of them at once. Values added to an arena container must come from the
+// same arena.
+JsonArena *json_arena_create(void);
+void json_arena_reset(JsonArena *arena);
+void json_arena_free(JsonArena *arena);
+JsonArena *json_use_arena(JsonArena *arena);  // Returns the previous arena
+
 // Creation functions
 JsonValue *json_null(void);
 JsonValue *json_bool(bool value);
@@ -68,8 +82,15 @@ JsonValue *json_array_get(JsonValue *v, int index);
 // Parsing
 JsonValue *json_parse(const char *str);
 
+// Raw scanning of JSON text without building values. Positions point into
+// the text; NULL or false means malformed input.
+const char *json_skip_value(const char *p);
+bool json_scan_members(const char *obj, const char **keys, const char **values, int count);
+const char *json_scan_int_array(const char *p, int **items, int *count, int *capacity);
+
 // Stringify
 char *json_stringify(JsonValue *v);
+bool json_stringify_append(JsonValue *v, char **buf, int *len, int *capacity);
 
 // Cleanup
 void json_free(JsonValue *v);
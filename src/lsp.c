@@ -9,11 +9,19 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <time.h>
+
+#define LSP_READ_CHUNK (64 * 1024)   // Minimum free space offered to each read()
+#define LSP_HEADER_SPACE 32          // Room reserved for "Content-Length: N\r\n\r\n"
+#define LSP_MAX_IOV 64               // Messages gathered into one writev()
 
 // Pending request tracking
 typedef enum {
     REQ_SEMANTIC_TOKENS,
+    REQ_SEMANTIC_TOKENS_RANGE,
     REQ_HOVER,
     REQ_COMPLETION,
     REQ_TYPE_DEFINITION
@@ -25,10 +33,33 @@ typedef struct {
     PendingRequestType type;
     int line;
     int col;
+    int end_line;           // Last line of a semantic token range request
+    char *base_result_id;   // Result a semantic token delta was asked against
+    long long deadline_ms;  // Cancelled if still unanswered at this time, 0 if never
 } PendingRequest;
 
-// LSP client state
-static struct {
+// Framed message waiting for the server to read it. didChange messages
+// remember their document so a later full-text change can replace them.
+typedef struct {
+    char *data;
+    int len;
+    int sent;
+    char *change_uri;   // Set for didChange notifications
+} OutMessage;
+
+// Last semantic token result for a document, kept in its raw encoded form
+// so that delta responses can be applied to it. Only kept for servers that
+// support deltas.
+typedef struct {
+    char *uri;
+    char *result_id;
+    int *data;
+    int data_len;
+    int data_capacity;
+} SemanticTokenDoc;
+
+// State of one running language server
+typedef struct {
     pid_t pid;
     int stdin_fd;   // Write to clangd
     int stdout_fd;  // Read from clangd
@@ -36,77 +67,275 @@ static struct {
     bool initialized;
     bool running;
     char *command;
-    lsp_diagnostics_callback diagnostics_cb;
-    lsp_semantic_tokens_callback semantic_cb;
-    lsp_hover_callback hover_cb;
-    lsp_type_definition_callback type_def_cb;
-    lsp_completion_callback completion_cb;
     bool hover_supported;
     bool completion_supported;
     bool type_def_supported;
-
-    // Read buffer for incoming messages
+    bool incremental_sync;      // textDocumentSync.change == Incremental
+    bool utf8_positions;        // server agreed to byte-offset columns
+    bool semantic_delta;        // semanticTokens/full/delta
+    bool semantic_range;        // semanticTokens/range
+
+    // Incoming messages are parsed into in_arena and outgoing ones built
+    // in out_arena; each is reset once its message has been handled
+    JsonArena *in_arena;
+    JsonArena *out_arena;
+
+    // Read buffer for incoming messages; read_buf[read_start, read_buf_len)
+    // has not been handled yet
     char *read_buf;
+    int read_start;
     int read_buf_len;
     int read_buf_capacity;
 
-    // Pending requests (for matching responses)
+    // Outgoing messages are serialized here, behind LSP_HEADER_SPACE bytes
+    // left for their header
+    char *out_buf;
+    int out_buf_len;
+    int out_buf_capacity;
+
+    // Messages not yet written to the server, oldest at out_head
+    OutMessage *out_queue;
+    int out_head;
+    int out_count;
+    int out_capacity;
+
+    // Pending requests (for matching responses), an open-addressed table
+    // keyed by request id with a power of two capacity
     PendingRequest *pending;
     int pending_count;
     int pending_capacity;
+    int pending_token_count;        // Semantic token requests among them
+    long long next_deadline_ms;     // Earliest deadline, 0 if none
 
     // Semantic token type legend (from server capabilities)
     char **token_types;
     int token_type_count;
-} lsp = {0};
+
+    SemanticTokenDoc *token_docs;
+    int token_doc_count;
+    int token_doc_capacity;
+} LspServer;
+
+// Callbacks are shared by all servers
+static struct {
+    lsp_diagnostics_callback diagnostics_cb;
+    lsp_semantic_tokens_callback semantic_cb;
+    lsp_semantic_tokens_range_callback semantic_range_cb;
+    lsp_hover_callback hover_cb;
+    lsp_type_definition_callback type_def_cb;
+    lsp_completion_callback completion_cb;
+} callbacks = {0};
+
+// One server per distinct lsp_command, started the first time a file of
+// one of its languages is opened and kept running until lsp_shutdown
+static LspServer **servers;
+static int server_count;
+static int server_capacity;
 
 // Forward declarations
-static bool send_message(JsonValue *msg);
-static void handle_message(JsonValue *msg);
+static bool send_message(LspServer *lsp, JsonValue *msg);
+static void begin_message(LspServer *lsp);
+static void end_message(LspServer *lsp);
+static JsonValue *create_notification(const char *method, JsonValue *params);
+static void handle_message(LspServer *lsp, JsonValue *msg);
 static char *completion_doc_to_text(JsonValue *doc);
 static void free_completion_items(LspCompletionItem *items, int count);
 
-// Add a pending request
-static void add_pending_request(int id, const char *uri, PendingRequestType type, int line, int col) {
-    if (lsp.pending_count >= lsp.pending_capacity) {
-        int new_cap = lsp.pending_capacity == 0 ? 8 : lsp.pending_capacity * 2;
-        PendingRequest *new_pending = realloc(lsp.pending, new_cap * sizeof(PendingRequest));
-        if (!new_pending) return;
-        lsp.pending = new_pending;
-        lsp.pending_capacity = new_cap;
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000LL + (long long)(now.tv_nsec / 1000000LL);
+}
+
+// How long the server gets to answer before the request is cancelled.
+// Hover and completion match how long the editor waits for them. Semantic
+// tokens never expire: nothing asks for them again until the next edit,
+// and a cold server can take a long time over its first full reply. They
+// are only cancelled when a newer request for the document replaces them.
+static long long request_timeout_ms(PendingRequestType type) {
+    switch (type) {
+    case REQ_HOVER:
+    case REQ_COMPLETION:
+        return 1000;
+    case REQ_SEMANTIC_TOKENS:
+    case REQ_SEMANTIC_TOKENS_RANGE:
+        return 0;
+    default:
+        return 5000;
     }
-    lsp.pending[lsp.pending_count].id = id;
-    lsp.pending[lsp.pending_count].uri = uri ? strdup(uri) : NULL;
-    lsp.pending[lsp.pending_count].type = type;
-    lsp.pending[lsp.pending_count].line = line;
-    lsp.pending[lsp.pending_count].col = col;
-    lsp.pending_count++;
+}
+
+static bool is_token_request(PendingRequestType type) {
+    return type == REQ_SEMANTIC_TOKENS || type == REQ_SEMANTIC_TOKENS_RANGE;
+}
+
+static int pending_slot(LspServer *lsp, int id) {
+    return (int)(((unsigned)id * 2654435761u) & (unsigned)(lsp->pending_capacity - 1));
+}
+
+// Slot holding id, or the empty slot where it would go
+static PendingRequest *pending_lookup(LspServer *lsp, int id) {
+    int mask = lsp->pending_capacity - 1;
+    int i = pending_slot(lsp, id);
+    while (lsp->pending[i].id != 0 && lsp->pending[i].id != id) {
+        i = (i + 1) & mask;
+    }
+    return &lsp->pending[i];
+}
+
+// Keep the table at most half full
+static bool pending_reserve(LspServer *lsp) {
+    if ((lsp->pending_count + 1) * 2 <= lsp->pending_capacity) return true;
+
+    int new_cap = lsp->pending_capacity == 0 ? 16 : lsp->pending_capacity * 2;
+    PendingRequest *new_pending = calloc(new_cap, sizeof(PendingRequest));
+    if (!new_pending) return false;
+
+    PendingRequest *old = lsp->pending;
+    int old_cap = lsp->pending_capacity;
+    lsp->pending = new_pending;
+    lsp->pending_capacity = new_cap;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].id != 0) *pending_lookup(lsp, old[i].id) = old[i];
+    }
+    free(old);
+    return true;
+}
+
+// Add a pending request. Request ids start at 1, so id 0 marks a free slot.
+static PendingRequest *add_pending_request(LspServer *lsp, int id, const char *uri, PendingRequestType type, int line, int col) {
+    if (id <= 0 || !pending_reserve(lsp)) return NULL;
+
+    PendingRequest *req = pending_lookup(lsp, id);
+    if (req->id == 0) {
+        lsp->pending_count++;
+        if (is_token_request(type)) lsp->pending_token_count++;
+    }
+    req->id = id;
+    req->uri = uri ? strdup(uri) : NULL;
+    req->type = type;
+    req->line = line;
+    req->col = col;
+    req->end_line = -1;
+    req->base_result_id = NULL;
+    long long timeout = request_timeout_ms(type);
+    req->deadline_ms = timeout > 0 ? monotonic_ms() + timeout : 0;
+    if (req->deadline_ms == 0) return req;
+    if (lsp->next_deadline_ms == 0 || req->deadline_ms < lsp->next_deadline_ms) {
+        lsp->next_deadline_ms = req->deadline_ms;
+    }
+    return req;
+}
+
+static void free_pending_request(PendingRequest *req) {
+    free(req->uri);
+    free(req->base_result_id);
+}
+
+static PendingRequest *find_pending_request(LspServer *lsp, int id) {
+    if (id <= 0 || lsp->pending_count == 0) return NULL;
+    PendingRequest *req = pending_lookup(lsp, id);
+    return req->id != 0 ? req : NULL;
+}
+
+// Empty a slot, moving later entries of its probe run back so that every
+// entry stays reachable from its home slot
+static void remove_pending_slot(LspServer *lsp, int hole) {
+    if (is_token_request(lsp->pending[hole].type)) lsp->pending_token_count--;
+    int mask = lsp->pending_capacity - 1;
+    int i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (lsp->pending[i].id == 0) break;
+        int home = pending_slot(lsp, lsp->pending[i].id);
+        // Move the entry unless its home lies cyclically in (hole, i]
+        bool reachable = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!reachable) {
+            lsp->pending[hole] = lsp->pending[i];
+            hole = i;
+        }
+    }
+    memset(&lsp->pending[hole], 0, sizeof(PendingRequest));
+    lsp->pending_count--;
 }
 
 // Find and remove a pending request by ID
-static bool pop_pending_request(int id, PendingRequest *out) {
-    for (int i = 0; i < lsp.pending_count; i++) {
-        if (lsp.pending[i].id == id) {
-            if (out) {
-                *out = lsp.pending[i];
-            }
-            // Remove by shifting
-            for (int j = i; j < lsp.pending_count - 1; j++) {
-                lsp.pending[j] = lsp.pending[j + 1];
-            }
-            lsp.pending_count--;
-            return true;
+static bool pop_pending_request(LspServer *lsp, int id, PendingRequest *out) {
+    PendingRequest *req = find_pending_request(lsp, id);
+    if (!req) return false;
+    if (out) {
+        *out = *req;
+    } else {
+        free_pending_request(req);
+    }
+    remove_pending_slot(lsp, (int)(req - lsp->pending));
+    return true;
+}
+
+// Tell the server a request's result is no longer wanted and forget it
+static void cancel_request(LspServer *lsp, int id) {
+    if (!pop_pending_request(lsp, id, NULL)) return;
+
+    begin_message(lsp);
+    JsonValue *params = json_object();
+    json_object_set(params, "id", json_number(id));
+    JsonValue *notif = create_notification("$/cancelRequest", params);
+    send_message(lsp, notif);
+    json_free(notif);
+    end_message(lsp);
+}
+
+// A new hover or completion replaces whatever is still outstanding, and
+// new semantic tokens replace earlier ones for the same document. Must be
+// called before the new request is built.
+static void cancel_superseded_requests(LspServer *lsp, PendingRequestType type, const char *uri) {
+    bool per_document = is_token_request(type);
+    int i = 0;
+    while (i < lsp->pending_capacity) {
+        PendingRequest *req = &lsp->pending[i];
+        if (req->id != 0 && req->type == type &&
+            (!per_document || (req->uri && uri && strcmp(req->uri, uri) == 0))) {
+            // Removal may move a later entry into this slot, so restart
+            cancel_request(lsp, req->id);
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+}
+
+// Cancel the requests whose deadline has passed
+static void expire_pending_requests(LspServer *lsp) {
+    if (lsp->next_deadline_ms == 0) return;
+    long long now = monotonic_ms();
+    if (now < lsp->next_deadline_ms) return;
+
+    lsp->next_deadline_ms = 0;
+    int i = 0;
+    while (i < lsp->pending_capacity) {
+        PendingRequest *req = &lsp->pending[i];
+        if (req->id != 0 && req->deadline_ms != 0 && req->deadline_ms <= now) {
+            cancel_request(lsp, req->id);
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+    for (i = 0; i < lsp->pending_capacity; i++) {
+        PendingRequest *req = &lsp->pending[i];
+        if (req->id != 0 && req->deadline_ms != 0 &&
+            (lsp->next_deadline_ms == 0 || req->deadline_ms < lsp->next_deadline_ms)) {
+            lsp->next_deadline_ms = req->deadline_ms;
         }
     }
-    return false;
 }
 
 // Map clangd token type string to our enum
-static SemanticTokenType map_token_type(int index) {
-    if (index < 0 || index >= lsp.token_type_count || !lsp.token_types) {
+static SemanticTokenType map_token_type(LspServer *lsp, int index) {
+    if (index < 0 || index >= lsp->token_type_count || !lsp->token_types) {
         return TOKEN_UNKNOWN;
     }
-    const char *type = lsp.token_types[index];
+    const char *type = lsp->token_types[index];
     if (!type) return TOKEN_UNKNOWN;
 
     if (strcmp(type, "variable") == 0) return TOKEN_VARIABLE;
@@ -160,41 +389,185 @@ char *lsp_uri_to_path(const char *uri) {
     return strdup(uri);
 }
 
-static bool send_raw(const char *data, int len) {
-    int written = 0;
-    while (written < len) {
-        int n = write(lsp.stdin_fd, data + written, len - written);
+static void free_out_message(OutMessage *m) {
+    free(m->data);
+    free(m->change_uri);
+}
+
+static void clear_out_queue(LspServer *lsp) {
+    for (int i = lsp->out_head; i < lsp->out_count; i++) {
+        free_out_message(&lsp->out_queue[i]);
+    }
+    lsp->out_head = 0;
+    lsp->out_count = 0;
+}
+
+// Write the queued messages followed by extra, a message that has not been
+// queued, gathering as many as possible into one writev(). *extra_sent is
+// how much of extra went out. Returns false if the server has gone away, in
+// which case the queue is dropped.
+static bool write_out(LspServer *lsp, const char *extra, int extra_len, int *extra_sent) {
+    *extra_sent = 0;
+    while (1) {
+        struct iovec iov[LSP_MAX_IOV];
+        int iov_count = 0;
+        size_t total = 0;
+        for (int i = lsp->out_head; i < lsp->out_count && iov_count < LSP_MAX_IOV - 1; i++) {
+            OutMessage *m = &lsp->out_queue[i];
+            iov[iov_count].iov_base = m->data + m->sent;
+            iov[iov_count].iov_len = m->len - m->sent;
+            total += iov[iov_count++].iov_len;
+        }
+        // extra may only follow once everything queued before it is included
+        if (extra && *extra_sent < extra_len && iov_count == lsp->out_count - lsp->out_head) {
+            iov[iov_count].iov_base = (char *)extra + *extra_sent;
+            iov[iov_count].iov_len = extra_len - *extra_sent;
+            total += iov[iov_count++].iov_len;
+        }
+        if (iov_count == 0) break;
+
+        ssize_t n = writev(lsp->stdin_fd, iov, iov_count);
         if (n < 0) {
             if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            clear_out_queue(lsp);
             return false;
         }
-        written += n;
+
+        size_t written = (size_t)n;
+        while (written > 0 && lsp->out_head < lsp->out_count) {
+            OutMessage *m = &lsp->out_queue[lsp->out_head];
+            size_t take = (size_t)(m->len - m->sent);
+            if (take > written) take = written;
+            m->sent += (int)take;
+            written -= take;
+            if (m->sent < m->len) break;
+            free_out_message(m);
+            lsp->out_head++;
+        }
+        *extra_sent += (int)written;
+
+        // A short write means the pipe is full
+        if ((size_t)n < total) return true;
     }
+    lsp->out_head = 0;
+    lsp->out_count = 0;
     return true;
 }
 
-static bool send_message(JsonValue *msg) {
-    if (!lsp.running || !msg) return false;
+static bool flush_out_queue(LspServer *lsp) {
+    int unused;
+    return write_out(lsp, NULL, 0, &unused);
+}
+
+// A full-text didChange supersedes the changes to the same document still
+// waiting behind it, back to the last other message (which may depend on
+// them) or the one being written
+static void drop_superseded_changes(LspServer *lsp, const char *uri) {
+    int first = lsp->out_head;
+    for (int i = lsp->out_count - 1; i >= lsp->out_head; i--) {
+        OutMessage *m = &lsp->out_queue[i];
+        if (!m->change_uri || m->sent > 0) {
+            first = i + 1;
+            break;
+        }
+    }
+    int keep = first;
+    for (int i = first; i < lsp->out_count; i++) {
+        OutMessage *m = &lsp->out_queue[i];
+        if (strcmp(m->change_uri, uri) == 0) {
+            free_out_message(m);
+        } else {
+            lsp->out_queue[keep++] = *m;
+        }
+    }
+    lsp->out_count = keep;
+}
+
+static bool queue_message(LspServer *lsp, char *data, int len, int sent, const char *change_uri) {
+    if (lsp->out_count >= lsp->out_capacity && lsp->out_head > 0) {
+        memmove(lsp->out_queue, lsp->out_queue + lsp->out_head,
+                (lsp->out_count - lsp->out_head) * sizeof(OutMessage));
+        lsp->out_count -= lsp->out_head;
+        lsp->out_head = 0;
+    }
+    if (lsp->out_count >= lsp->out_capacity) {
+        int new_cap = lsp->out_capacity == 0 ? 16 : lsp->out_capacity * 2;
+        OutMessage *new_queue = realloc(lsp->out_queue, new_cap * sizeof(OutMessage));
+        if (!new_queue) return false;
+        lsp->out_queue = new_queue;
+        lsp->out_capacity = new_cap;
+    }
 
-    char *content = json_stringify(msg);
-    if (!content) return false;
+    char *uri_copy = NULL;
+    if (change_uri) {
+        uri_copy = strdup(change_uri);
+        if (!uri_copy) return false;
+    }
+    lsp->out_queue[lsp->out_count++] = (OutMessage){ data, len, sent, uri_copy };
+    return true;
+}
 
-    int content_len = strlen(content);
+// Frame msg and write it right away as far as the pipe allows. The server's
+// stdin is non-blocking, so a busy server never stalls the editor: what
+// does not fit is copied to the queue and goes out from the event loop via
+// lsp_process_fds.
+static bool send_message_ex(LspServer *lsp, JsonValue *msg, const char *change_uri, bool full_change) {
+    if (!lsp->running || !msg) return false;
+
+    // Serialize behind the header space, then put the header right before
+    // the content so the message is one contiguous block
+    lsp->out_buf_len = LSP_HEADER_SPACE;
+    if (!lsp->out_buf) {
+        lsp->out_buf_capacity = 4096;
+        lsp->out_buf = malloc(lsp->out_buf_capacity);
+        if (!lsp->out_buf) return false;
+    }
+    if (!json_stringify_append(msg, &lsp->out_buf, &lsp->out_buf_len, &lsp->out_buf_capacity)) {
+        return false;
+    }
 
-    // Send header
-    char header[64];
+    int content_len = lsp->out_buf_len - LSP_HEADER_SPACE;
+    char header[LSP_HEADER_SPACE + 1];
     int header_len = snprintf(header, sizeof(header),
                               "Content-Length: %d\r\n\r\n", content_len);
+    char *data = lsp->out_buf + LSP_HEADER_SPACE - header_len;
+    memcpy(data, header, header_len);
+    int len = header_len + content_len;
 
-    bool ok = send_raw(header, header_len) && send_raw(content, content_len);
-    free(content);
-    return ok;
+    if (full_change) drop_superseded_changes(lsp, change_uri);
+
+    int sent = 0;
+    if (!write_out(lsp, data, len, &sent)) return false;
+    if (sent == len) return true;
+
+    char *copy = malloc(len);
+    if (!copy) return false;
+    memcpy(copy, data, len);
+    if (!queue_message(lsp, copy, len, sent, change_uri)) {
+        free(copy);
+        return false;
+    }
+    return true;
 }
 
-static JsonValue *create_request(const char *method, JsonValue *params) {
+static bool send_message(LspServer *lsp, JsonValue *msg) {
+    return send_message_ex(lsp, msg, NULL, false);
+}
+
+static void begin_message(LspServer *lsp) {
+    json_use_arena(lsp->out_arena);
+}
+
+static void end_message(LspServer *lsp) {
+    json_use_arena(NULL);
+    json_arena_reset(lsp->out_arena);
+}
+
+static JsonValue *create_request(LspServer *lsp, const char *method, JsonValue *params) {
     JsonValue *msg = json_object();
     json_object_set(msg, "jsonrpc", json_string("2.0"));
-    json_object_set(msg, "id", json_number(++lsp.request_id));
+    json_object_set(msg, "id", json_number(++lsp->request_id));
     json_object_set(msg, "method", json_string(method));
     if (params) {
         json_object_set(msg, "params", params);
@@ -212,52 +585,297 @@ static JsonValue *create_notification(const char *method, JsonValue *params) {
     return msg;
 }
 
-static void handle_semantic_tokens_response(const char *uri, JsonValue *result) {
-    if (!result || !lsp.semantic_cb) return;
-
-    JsonValue *data = json_object_get(result, "data");
-    if (!data) return;
+static SemanticTokenDoc *find_token_doc(LspServer *lsp, const char *uri, bool create) {
+    for (int i = 0; i < lsp->token_doc_count; i++) {
+        if (strcmp(lsp->token_docs[i].uri, uri) == 0) return &lsp->token_docs[i];
+    }
+    if (!create) return NULL;
+
+    if (lsp->token_doc_count >= lsp->token_doc_capacity) {
+        int new_cap = lsp->token_doc_capacity == 0 ? 8 : lsp->token_doc_capacity * 2;
+        SemanticTokenDoc *new_docs = realloc(lsp->token_docs, new_cap * sizeof(SemanticTokenDoc));
+        if (!new_docs) return NULL;
+        lsp->token_docs = new_docs;
+        lsp->token_doc_capacity = new_cap;
+    }
+    SemanticTokenDoc *doc = &lsp->token_docs[lsp->token_doc_count];
+    memset(doc, 0, sizeof(*doc));
+    doc->uri = strdup(uri);
+    if (!doc->uri) return NULL;
+    lsp->token_doc_count++;
+    return doc;
+}
 
-    int data_len = json_array_length(data);
-    if (data_len == 0 || data_len % 5 != 0) {
-        // Empty or invalid data
-        lsp.semantic_cb(uri, NULL, 0);
+static void drop_token_doc(LspServer *lsp, const char *uri) {
+    for (int i = 0; i < lsp->token_doc_count; i++) {
+        SemanticTokenDoc *doc = &lsp->token_docs[i];
+        if (strcmp(doc->uri, uri) != 0) continue;
+        free(doc->uri);
+        free(doc->result_id);
+        free(doc->data);
+        lsp->token_docs[i] = lsp->token_docs[--lsp->token_doc_count];
         return;
     }
+}
+
+static bool token_doc_reserve(SemanticTokenDoc *doc, int len) {
+    if (len <= doc->data_capacity) return true;
+    int new_cap = doc->data_capacity == 0 ? 256 : doc->data_capacity;
+    while (new_cap < len) new_cap *= 2;
+    int *new_data = realloc(doc->data, new_cap * sizeof(int));
+    if (!new_data) return false;
+    doc->data = new_data;
+    doc->data_capacity = new_cap;
+    return true;
+}
+
+static bool read_token_ints(JsonValue *array, int *out) {
+    int len = json_array_length(array);
+    for (int i = 0; i < len; i++) {
+        JsonValue *v = json_array_get(array, i);
+        if (!v || v->type != JSON_NUMBER) return false;
+        out[i] = (int)json_get_number(v);
+    }
+    return true;
+}
+
+// Decode delta-encoded tokens and hand them to the callback
+// Format: [deltaLine, deltaStartChar, length, tokenType, tokenModifiers] * N
+static SemanticToken *decode_semantic_tokens(LspServer *lsp, const int *data, int data_len, int *out_count) {
+    *out_count = 0;
+    if (data_len == 0 || data_len % 5 != 0) return NULL;
 
     int token_count = data_len / 5;
     SemanticToken *tokens = calloc(token_count, sizeof(SemanticToken));
-    if (!tokens) return;
+    if (!tokens) return NULL;
 
-    // Decode delta-encoded tokens
-    // Format: [deltaLine, deltaStartChar, length, tokenType, tokenModifiers] * N
     int line = 0;
     int col = 0;
-
     for (int i = 0; i < token_count; i++) {
-        int deltaLine = (int)json_get_number(json_array_get(data, i * 5 + 0));
-        int deltaCol = (int)json_get_number(json_array_get(data, i * 5 + 1));
-        int length = (int)json_get_number(json_array_get(data, i * 5 + 2));
-        int tokenType = (int)json_get_number(json_array_get(data, i * 5 + 3));
-        // int tokenModifiers = (int)json_get_number(json_array_get(data, i * 5 + 4));
-
-        if (deltaLine > 0) {
-            line += deltaLine;
-            col = deltaCol;
+        const int *t = data + i * 5;
+        if (t[0] > 0) {
+            line += t[0];
+            col = t[1];
         } else {
-            col += deltaCol;
+            col += t[1];
         }
 
         tokens[i].line = line;
         tokens[i].col = col;
-        tokens[i].length = length;
-        tokens[i].type = map_token_type(tokenType);
+        tokens[i].length = t[2];
+        tokens[i].type = map_token_type(lsp, t[3]);
     }
+    *out_count = token_count;
+    return tokens;
+}
+
+typedef struct {
+    int start;
+    int delete_count;
+    JsonValue *data;
+} TokenEdit;
 
-    lsp.semantic_cb(uri, tokens, token_count);
+static int compare_token_edits(const void *a, const void *b) {
+    return ((const TokenEdit *)b)->start - ((const TokenEdit *)a)->start;
+}
+
+// Apply SemanticTokensEdit entries (offsets into the previous data) back
+// to front so earlier offsets stay valid
+static bool apply_token_edits(SemanticTokenDoc *doc, JsonValue *edits) {
+    int count = json_array_length(edits);
+    if (count == 0) return true;
+
+    TokenEdit *list = calloc(count, sizeof(TokenEdit));
+    if (!list) return false;
+    for (int i = 0; i < count; i++) {
+        JsonValue *edit = json_array_get(edits, i);
+        JsonValue *start = edit ? json_object_get(edit, "start") : NULL;
+        JsonValue *delete_count = edit ? json_object_get(edit, "deleteCount") : NULL;
+        if (!start || !delete_count) {
+            free(list);
+            return false;
+        }
+        list[i].start = (int)json_get_number(start);
+        list[i].delete_count = (int)json_get_number(delete_count);
+        list[i].data = json_object_get(edit, "data");
+    }
+    qsort(list, count, sizeof(TokenEdit), compare_token_edits);
+
+    bool ok = true;
+    int limit = doc->data_len;
+    for (int i = 0; i < count && ok; i++) {
+        TokenEdit *edit = &list[i];
+        int insert = edit->data ? json_array_length(edit->data) : 0;
+        if (edit->start < 0 || edit->delete_count < 0 || edit->start + edit->delete_count > limit) {
+            ok = false;
+            break;
+        }
+        int new_len = doc->data_len - edit->delete_count + insert;
+        if (!token_doc_reserve(doc, new_len)) {
+            ok = false;
+            break;
+        }
+        int tail = edit->start + edit->delete_count;
+        memmove(doc->data + edit->start + insert, doc->data + tail,
+                (doc->data_len - tail) * sizeof(int));
+        if (insert > 0 && !read_token_ints(edit->data, doc->data + edit->start)) ok = false;
+        doc->data_len = new_len;
+        limit = edit->start;
+    }
+    free(list);
+    return ok;
+}
+
+static void deliver_semantic_tokens(LspServer *lsp, const PendingRequest *req, const int *data, int data_len) {
+    int token_count = 0;
+    SemanticToken *tokens = decode_semantic_tokens(lsp, data, data_len, &token_count);
+    callbacks.semantic_cb(req->uri, tokens, token_count);
     free(tokens);
 }
 
+// Store the new resultId and hand the document's tokens to the editor
+static void deliver_token_doc(LspServer *lsp, const PendingRequest *req, SemanticTokenDoc *doc, const char *result_id) {
+    free(doc->result_id);
+    doc->result_id = result_id ? strdup(result_id) : NULL;
+    deliver_semantic_tokens(lsp, req, doc->data, doc->data_len);
+}
+
+static void handle_semantic_tokens_response(LspServer *lsp, const PendingRequest *req, JsonValue *result) {
+    if (!result || !callbacks.semantic_cb) return;
+
+    JsonValue *data = json_object_get(result, "data");
+    JsonValue *edits = json_object_get(result, "edits");
+
+    // The raw data is only kept to apply later deltas to
+    if (!lsp->semantic_delta) {
+        if (!data || data->type != JSON_ARRAY) return;
+        int len = json_array_length(data);
+        int *ints = malloc((len > 0 ? len : 1) * sizeof(int));
+        if (!ints) return;
+        if (read_token_ints(data, ints)) {
+            deliver_semantic_tokens(lsp, req, ints, len);
+        }
+        free(ints);
+        return;
+    }
+
+    SemanticTokenDoc *doc = find_token_doc(lsp, req->uri, true);
+    if (!doc) return;
+
+    bool ok = false;
+    if (data && data->type == JSON_ARRAY) {
+        int len = json_array_length(data);
+        doc->data_len = 0;
+        ok = token_doc_reserve(doc, len) && read_token_ints(data, doc->data);
+        if (ok) doc->data_len = len;
+    } else if (edits && edits->type == JSON_ARRAY) {
+        // A delta only applies to the result it was requested against
+        ok = req->base_result_id && doc->result_id &&
+             strcmp(req->base_result_id, doc->result_id) == 0 &&
+             apply_token_edits(doc, edits);
+    }
+    if (!ok) {
+        // Forget the result so the next request asks for the full set
+        drop_token_doc(lsp, req->uri);
+        return;
+    }
+
+    JsonValue *result_id = json_object_get(result, "resultId");
+    deliver_token_doc(lsp, req, doc, result_id ? json_get_string(result_id) : NULL);
+}
+
+static void deliver_semantic_tokens_range(LspServer *lsp, const PendingRequest *req, const int *data, int data_len) {
+    int token_count = 0;
+    SemanticToken *tokens = decode_semantic_tokens(lsp, data, data_len, &token_count);
+    callbacks.semantic_range_cb(req->uri, tokens, token_count, req->line, req->end_line);
+    free(tokens);
+}
+
+static void handle_semantic_tokens_range_response(LspServer *lsp, const PendingRequest *req, JsonValue *result) {
+    if (!result || !callbacks.semantic_range_cb) return;
+
+    JsonValue *data = json_object_get(result, "data");
+    if (!data || data->type != JSON_ARRAY) return;
+
+    int len = json_array_length(data);
+    int *ints = malloc((len > 0 ? len : 1) * sizeof(int));
+    if (!ints) return;
+    if (read_token_ints(data, ints)) {
+        deliver_semantic_tokens_range(lsp, req, ints, len);
+    }
+    free(ints);
+}
+
+// Semantic token responses can carry hundreds of thousands of integers.
+// Read the data array of a full or range result straight from the message
+// text instead of building a JsonValue per number. Returns false when the
+// message should go through the generic path (deltas, errors, other
+// messages, or anything the scanner does not expect). Nothing is scanned
+// while no semantic token request is outstanding, so other messages are
+// only read once.
+static bool handle_semantic_tokens_raw(LspServer *lsp, const char *content) {
+    if (lsp->pending_token_count == 0) return false;
+
+    const char *keys[] = { "id", "method", "result" };
+    const char *values[3];
+    if (!json_scan_members(content, keys, values, 3)) return false;
+    if (!values[0] || values[1] || !values[2] || *values[2] != '{') return false;
+
+    char *end;
+    long id = strtol(values[0], &end, 10);
+    if (end == values[0]) return false;
+
+    PendingRequest *pending = find_pending_request(lsp, (int)id);
+    if (!pending || !is_token_request(pending->type) || !pending->uri) {
+        return false;
+    }
+
+    const char *result_keys[] = { "data", "resultId" };
+    const char *result_values[2];
+    if (!json_scan_members(values[2], result_keys, result_values, 2)) return false;
+    if (!result_values[0] || *result_values[0] != '[') return false;
+
+    if (pending->type == REQ_SEMANTIC_TOKENS && lsp->semantic_delta) {
+        if (!callbacks.semantic_cb) return false;
+        SemanticTokenDoc *doc = find_token_doc(lsp, pending->uri, true);
+        if (!doc) return false;
+        doc->data_len = 0;
+        if (!json_scan_int_array(result_values[0], &doc->data, &doc->data_len, &doc->data_capacity)) {
+            return false;
+        }
+
+        JsonValue *result_id = result_values[1] ? json_parse(result_values[1]) : NULL;
+        PendingRequest req;
+        pop_pending_request(lsp, (int)id, &req);
+        deliver_token_doc(lsp, &req, doc, json_get_string(result_id));
+        json_free(result_id);
+        free_pending_request(&req);
+    } else {
+        // Range results, and full results from a server without deltas,
+        // are decoded and dropped
+        bool full = pending->type == REQ_SEMANTIC_TOKENS;
+        if (full ? !callbacks.semantic_cb : !callbacks.semantic_range_cb) return false;
+        int *ints = NULL;
+        int len = 0;
+        int capacity = 0;
+        if (!json_scan_int_array(result_values[0], &ints, &len, &capacity)) {
+            free(ints);
+            return false;
+        }
+
+        PendingRequest req;
+        pop_pending_request(lsp, (int)id, &req);
+        if (full) {
+            deliver_semantic_tokens(lsp, &req, ints, len);
+        } else {
+            deliver_semantic_tokens_range(lsp, &req, ints, len);
+        }
+        free(ints);
+        free_pending_request(&req);
+    }
+    return true;
+}
+
 static void append_text(char **buf, int *len, int *cap, const char *text) {
     if (!text || !buf || !len || !cap) return;
     int add_len = (int)strlen(text);
@@ -389,7 +1007,7 @@ static char *hover_contents_to_text(JsonValue *contents) {
 }
 
 static void handle_diagnostics(JsonValue *params) {
-    if (!params || !lsp.diagnostics_cb) return;
+    if (!params || !callbacks.diagnostics_cb) return;
 
     JsonValue *uri_val = json_object_get(params, "uri");
     JsonValue *diags_arr = json_object_get(params, "diagnostics");
@@ -452,7 +1070,7 @@ static void handle_diagnostics(JsonValue *params) {
     }
 
     // Call the callback
-    lsp.diagnostics_cb(uri, diags, count);
+    callbacks.diagnostics_cb(uri, diags, count);
 
     // Clean up (callback should copy what it needs)
     for (int i = 0; i < count; i++) {
@@ -463,23 +1081,23 @@ static void handle_diagnostics(JsonValue *params) {
 }
 
 static void handle_hover_response(const PendingRequest *req, JsonValue *result) {
-    if (!req || !lsp.hover_cb) return;
+    if (!req || !callbacks.hover_cb) return;
     if (!result) {
-        lsp.hover_cb(req->uri, req->line, req->col, NULL);
+        callbacks.hover_cb(req->uri, req->line, req->col, NULL);
         return;
     }
     JsonValue *contents = json_object_get(result, "contents");
     if (!contents) {
-        lsp.hover_cb(req->uri, req->line, req->col, NULL);
+        callbacks.hover_cb(req->uri, req->line, req->col, NULL);
         return;
     }
     char *text = hover_contents_to_text(contents);
     if (!text || text[0] == '\0') {
         free(text);
-        lsp.hover_cb(req->uri, req->line, req->col, NULL);
+        callbacks.hover_cb(req->uri, req->line, req->col, NULL);
         return;
     }
-    lsp.hover_cb(req->uri, req->line, req->col, text);
+    callbacks.hover_cb(req->uri, req->line, req->col, text);
     free(text);
 }
 
@@ -510,9 +1128,9 @@ static bool extract_location_from_object(JsonValue *loc, const char **out_uri, i
 }
 
 static void handle_type_definition_response(const PendingRequest *req, JsonValue *result) {
-    if (!req || !lsp.type_def_cb) return;
+    if (!req || !callbacks.type_def_cb) return;
     if (!result) {
-        lsp.type_def_cb(req->uri, -1, -1);
+        callbacks.type_def_cb(req->uri, -1, -1);
         return;
     }
 
@@ -528,20 +1146,20 @@ static void handle_type_definition_response(const PendingRequest *req, JsonValue
     }
 
     if (!uri) {
-        lsp.type_def_cb(req->uri, -1, -1);
+        callbacks.type_def_cb(req->uri, -1, -1);
         return;
     }
 
     char *uri_copy = strdup(uri);
     if (!uri_copy) {
-        lsp.type_def_cb(req->uri, -1, -1);
+        callbacks.type_def_cb(req->uri, -1, -1);
         return;
     }
-    lsp.type_def_cb(uri_copy, line, col);
+    callbacks.type_def_cb(uri_copy, line, col);
     free(uri_copy);
 }
 
-static void handle_message(JsonValue *msg) {
+static void handle_message(LspServer *lsp, JsonValue *msg) {
     if (!msg) return;
 
     // Check if it's a notification
@@ -579,65 +1197,99 @@ static void handle_message(JsonValue *msg) {
                 JsonValue *hoverProvider = json_object_get(caps, "hoverProvider");
                 if (hoverProvider) {
                     if (hoverProvider->type == JSON_BOOL) {
-                        lsp.hover_supported = json_get_bool(hoverProvider);
+                        lsp->hover_supported = json_get_bool(hoverProvider);
                     } else if (hoverProvider->type == JSON_OBJECT) {
-                        lsp.hover_supported = true;
+                        lsp->hover_supported = true;
                     }
                 }
                 JsonValue *completionProvider = json_object_get(caps, "completionProvider");
                 if (completionProvider) {
                     if (completionProvider->type == JSON_BOOL) {
-                        lsp.completion_supported = json_get_bool(completionProvider);
+                        lsp->completion_supported = json_get_bool(completionProvider);
                     } else if (completionProvider->type == JSON_OBJECT) {
-                        lsp.completion_supported = true;
+                        lsp->completion_supported = true;
                     }
                 }
                 JsonValue *semTokens = json_object_get(caps, "semanticTokensProvider");
                 if (semTokens) {
+                    JsonValue *full = json_object_get(semTokens, "full");
+                    if (full && full->type == JSON_OBJECT) {
+                        JsonValue *delta = json_object_get(full, "delta");
+                        lsp->semantic_delta = delta && delta->type == JSON_BOOL && json_get_bool(delta);
+                    }
+                    JsonValue *range = json_object_get(semTokens, "range");
+                    if (range) {
+                        if (range->type == JSON_BOOL) {
+                            lsp->semantic_range = json_get_bool(range);
+                        } else if (range->type == JSON_OBJECT) {
+                            lsp->semantic_range = true;
+                        }
+                    }
                     JsonValue *legend = json_object_get(semTokens, "legend");
                     if (legend) {
                         JsonValue *tokenTypes = json_object_get(legend, "tokenTypes");
                         if (tokenTypes) {
                             int count = json_array_length(tokenTypes);
-                            lsp.token_types = calloc(count, sizeof(char*));
-                            lsp.token_type_count = count;
+                            lsp->token_types = calloc(count, sizeof(char*));
+                            lsp->token_type_count = count;
                             for (int i = 0; i < count; i++) {
                                 const char *t = json_get_string(json_array_get(tokenTypes, i));
-                                if (t) lsp.token_types[i] = strdup(t);
+                                if (t) lsp->token_types[i] = strdup(t);
                             }
                         }
                     }
                 }
+                JsonValue *sync = json_object_get(caps, "textDocumentSync");
+                if (sync) {
+                    JsonValue *change = sync;
+                    if (sync->type == JSON_OBJECT) {
+                        change = json_object_get(sync, "change");
+                    }
+                    if (change && change->type == JSON_NUMBER) {
+                        lsp->incremental_sync = (int)json_get_number(change) == 2;
+                    }
+                }
+                JsonValue *encoding = json_object_get(caps, "positionEncoding");
+                if (encoding && encoding->type == JSON_STRING) {
+                    const char *enc = json_get_string(encoding);
+                    lsp->utf8_positions = enc && strcmp(enc, "utf-8") == 0;
+                }
                 JsonValue *typeDefProvider = json_object_get(caps, "typeDefinitionProvider");
                 if (typeDefProvider) {
                     if (typeDefProvider->type == JSON_BOOL) {
-                        lsp.type_def_supported = json_get_bool(typeDefProvider);
+                        lsp->type_def_supported = json_get_bool(typeDefProvider);
                     } else if (typeDefProvider->type == JSON_OBJECT) {
-                        lsp.type_def_supported = true;
+                        lsp->type_def_supported = true;
                     }
                 }
             }
         }
 
         PendingRequest req = {0};
-        if (pop_pending_request(req_id, &req)) {
+        if (pop_pending_request(lsp, req_id, &req)) {
             if (req.type == REQ_SEMANTIC_TOKENS) {
                 if (req.uri && result) {
-                    handle_semantic_tokens_response(req.uri, result);
+                    handle_semantic_tokens_response(lsp, &req, result);
+                } else if (req.uri) {
+                    drop_token_doc(lsp, req.uri);
+                }
+            } else if (req.type == REQ_SEMANTIC_TOKENS_RANGE) {
+                if (req.uri && result) {
+                    handle_semantic_tokens_range_response(lsp, &req, result);
                 }
             } else if (req.type == REQ_HOVER) {
-                if (!result && error_msg && lsp.hover_cb) {
+                if (!result && error_msg && callbacks.hover_cb) {
                     char buf[256];
                     snprintf(buf, sizeof(buf), "Hover error: %s", error_msg);
-                    lsp.hover_cb(req.uri, req.line, req.col, buf);
+                    callbacks.hover_cb(req.uri, req.line, req.col, buf);
                 } else {
                     handle_hover_response(&req, result);
                 }
             } else if (req.type == REQ_COMPLETION) {
-                if (!lsp.completion_cb) {
+                if (!callbacks.completion_cb) {
                     // Nothing to do
                 } else if (!result && error_msg) {
-                    lsp.completion_cb(req.uri, req.line, req.col, NULL, 0);
+                    callbacks.completion_cb(req.uri, req.line, req.col, NULL, 0);
                 } else if (result) {
                     JsonValue *items = NULL;
                     bool is_incomplete = false;
@@ -655,15 +1307,15 @@ static void handle_message(JsonValue *msg) {
                     }
 
                     if (!items) {
-                        lsp.completion_cb(req.uri, req.line, req.col, NULL, 0);
+                        callbacks.completion_cb(req.uri, req.line, req.col, NULL, 0);
                     } else {
                         int count = json_array_length(items);
                         LspCompletionItem *out = NULL;
                         if (count > 0) {
                             out = calloc(count, sizeof(LspCompletionItem));
                             if (!out) {
-                                lsp.completion_cb(req.uri, req.line, req.col, NULL, 0);
-                                if (req.uri) free(req.uri);
+                                callbacks.completion_cb(req.uri, req.line, req.col, NULL, 0);
+                                free_pending_request(&req);
                                 return;
                             }
                         }
@@ -692,32 +1344,44 @@ static void handle_message(JsonValue *msg) {
                             // We don't implement resolution; still return what we have.
                         }
 
-                        lsp.completion_cb(req.uri, req.line, req.col, out, out_count);
+                        callbacks.completion_cb(req.uri, req.line, req.col, out, out_count);
                         free_completion_items(out, out_count);
                         free(out);
                     }
                 }
             } else if (req.type == REQ_TYPE_DEFINITION) {
-                if (!result && error_msg && lsp.type_def_cb) {
-                    lsp.type_def_cb(req.uri, -1, -1);
+                if (!result && error_msg && callbacks.type_def_cb) {
+                    callbacks.type_def_cb(req.uri, -1, -1);
                 } else {
                     handle_type_definition_response(&req, result);
                 }
             }
-            if (req.uri) free(req.uri);
+            free_pending_request(&req);
         }
     }
 }
 
-static bool buf_ensure_capacity(int needed) {
-    if (lsp.read_buf_len + needed >= lsp.read_buf_capacity) {
-        int new_cap = lsp.read_buf_capacity == 0 ? 4096 : lsp.read_buf_capacity * 2;
-        while (new_cap < lsp.read_buf_len + needed) new_cap *= 2;
-        char *new_buf = realloc(lsp.read_buf, new_cap);
-        if (!new_buf) return false;
-        lsp.read_buf = new_buf;
-        lsp.read_buf_capacity = new_cap;
+// Make room for at least needed more bytes after read_buf_len, plus one
+// for the terminator put after a message while it is parsed. Handled input
+// is dropped from the front only when that frees at least as much as it
+// moves, so each byte is moved a bounded number of times.
+static bool buf_ensure_capacity(LspServer *lsp, int needed) {
+    if (lsp->read_buf_len + needed < lsp->read_buf_capacity) return true;
+
+    int pending = lsp->read_buf_len - lsp->read_start;
+    if (lsp->read_start > 0 && lsp->read_start >= pending) {
+        memmove(lsp->read_buf, lsp->read_buf + lsp->read_start, pending);
+        lsp->read_start = 0;
+        lsp->read_buf_len = pending;
+        if (lsp->read_buf_len + needed < lsp->read_buf_capacity) return true;
     }
+
+    int new_cap = lsp->read_buf_capacity == 0 ? LSP_READ_CHUNK * 2 : lsp->read_buf_capacity * 2;
+    while (new_cap <= lsp->read_buf_len + needed) new_cap *= 2;
+    char *new_buf = realloc(lsp->read_buf, new_cap);
+    if (!new_buf) return false;
+    lsp->read_buf = new_buf;
+    lsp->read_buf_capacity = new_cap;
     return true;
 }
 
@@ -794,15 +1458,26 @@ static char **parse_command(const char *command, int *argc) {
     return argv;
 }
 
-bool lsp_init(const char *command) {
-    if (!command) return false;
-    if (lsp.running) {
-        if (lsp.command && strcmp(lsp.command, command) == 0) {
-            return true;
-        }
-        lsp_shutdown();
+static LspServer *find_server(const char *command) {
+    for (int i = 0; i < server_count; i++) {
+        if (servers[i]->command && strcmp(servers[i]->command, command) == 0) return servers[i];
     }
+    return NULL;
+}
+
+// Running server for the language of path, or NULL
+static LspServer *server_for_path(const char *path) {
+    if (!path) return NULL;
+    const char *ext = strrchr(path, '.');
+    if (!ext) return NULL;
+    LanguageConfig *cfg = editor_config_get_for_extension(ext);
+    if (!cfg || !cfg->lsp_command) return NULL;
+    LspServer *lsp = find_server(cfg->lsp_command);
+    return lsp && lsp->running ? lsp : NULL;
+}
 
+// Spawn command and send it the initialize request
+static bool start_server(LspServer *lsp, const char *command) {
     // Parse command into argv
     int argc;
     char **argv = parse_command(command, &argc);
@@ -861,18 +1536,24 @@ bool lsp_init(const char *command) {
     close(stdin_pipe[0]);  // Close read end
     close(stdout_pipe[1]); // Close write end
 
-    lsp.pid = pid;
-    lsp.stdin_fd = stdin_pipe[1];
-    lsp.stdout_fd = stdout_pipe[0];
-    lsp.running = true;
-    lsp.request_id = 0;
-    lsp.command = strdup(command);
+    lsp->pid = pid;
+    lsp->stdin_fd = stdin_pipe[1];
+    lsp->stdout_fd = stdout_pipe[0];
+    lsp->running = true;
+    lsp->request_id = 0;
+    lsp->command = strdup(command);
 
-    // Set stdout_fd to non-blocking
-    int flags = fcntl(lsp.stdout_fd, F_GETFL, 0);
-    fcntl(lsp.stdout_fd, F_SETFL, flags | O_NONBLOCK);
+    // Set both pipes to non-blocking
+    int flags = fcntl(lsp->stdout_fd, F_GETFL, 0);
+    fcntl(lsp->stdout_fd, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(lsp->stdin_fd, F_GETFL, 0);
+    fcntl(lsp->stdin_fd, F_SETFL, flags | O_NONBLOCK);
+
+    lsp->in_arena = json_arena_create();
+    lsp->out_arena = json_arena_create();
 
     // Send initialize request
+    begin_message(lsp);
     JsonValue *params = json_object();
     json_object_set(params, "processId", json_number(getpid()));
 
@@ -922,7 +1603,10 @@ bool lsp_init(const char *command) {
     JsonValue *semTokenCaps = json_object();
     json_object_set(semTokenCaps, "dynamicRegistration", json_bool(false));
     JsonValue *requests = json_object();
-    json_object_set(requests, "full", json_bool(true));
+    JsonValue *fullRequests = json_object();
+    json_object_set(fullRequests, "delta", json_bool(true));
+    json_object_set(requests, "full", fullRequests);
+    json_object_set(requests, "range", json_bool(true));
     json_object_set(semTokenCaps, "requests", requests);
     JsonValue *tokenTypes = json_array();
     json_array_push(tokenTypes, json_string("variable"));
@@ -948,66 +1632,136 @@ bool lsp_init(const char *command) {
     json_object_set(textDocCaps, "semanticTokens", semTokenCaps);
 
     json_object_set(capabilities, "textDocument", textDocCaps);
+
+    // Columns are byte offsets throughout the editor
+    JsonValue *generalCaps = json_object();
+    JsonValue *encodings = json_array();
+    json_array_push(encodings, json_string("utf-8"));
+    json_array_push(encodings, json_string("utf-16"));
+    json_object_set(generalCaps, "positionEncodings", encodings);
+    json_object_set(capabilities, "general", generalCaps);
+
     json_object_set(params, "capabilities", capabilities);
 
-    JsonValue *init_req = create_request("initialize", params);
-    send_message(init_req);
+    JsonValue *init_req = create_request(lsp, "initialize", params);
+    send_message(lsp, init_req);
     json_free(init_req);
+    end_message(lsp);
 
     return true;
 }
 
-void lsp_shutdown(void) {
-    if (!lsp.running) return;
+// Start the server for command unless it is already running. Servers for
+// other commands keep running alongside it.
+bool lsp_init(const char *command) {
+    if (!command) return false;
+    if (find_server(command)) return true;
+
+    if (server_count >= server_capacity) {
+        int new_cap = server_capacity == 0 ? 4 : server_capacity * 2;
+        LspServer **new_servers = realloc(servers, new_cap * sizeof(LspServer *));
+        if (!new_servers) return false;
+        servers = new_servers;
+        server_capacity = new_cap;
+    }
+    LspServer *lsp = calloc(1, sizeof(LspServer));
+    if (!lsp) return false;
+    if (!start_server(lsp, command)) {
+        free(lsp);
+        return false;
+    }
+    servers[server_count++] = lsp;
+    return true;
+}
+
+static void stop_server(LspServer *lsp) {
+    if (!lsp->running) return;
 
     // Send shutdown request
-    JsonValue *shutdown = create_request("shutdown", NULL);
-    send_message(shutdown);
+    begin_message(lsp);
+    JsonValue *shutdown = create_request(lsp, "shutdown", NULL);
+    send_message(lsp, shutdown);
     json_free(shutdown);
 
     // Send exit notification
     JsonValue *exit_notif = create_notification("exit", NULL);
-    send_message(exit_notif);
+    send_message(lsp, exit_notif);
     json_free(exit_notif);
+    end_message(lsp);
+
+    // Give the server a moment to take what is still queued
+    for (int waited = 0; lsp->out_head < lsp->out_count && waited < 10; waited++) {
+        struct pollfd pfd = { .fd = lsp->stdin_fd, .events = POLLOUT };
+        if (poll(&pfd, 1, 50) < 0 && errno != EINTR) break;
+        if (!flush_out_queue(lsp)) break;
+    }
+    clear_out_queue(lsp);
+    free(lsp->out_queue);
+    free(lsp->out_buf);
 
     // Close file descriptors
-    close(lsp.stdin_fd);
-    close(lsp.stdout_fd);
+    close(lsp->stdin_fd);
+    close(lsp->stdout_fd);
 
     // Wait for child process
-    if (lsp.pid > 0) {
+    if (lsp->pid > 0) {
         int status;
-        waitpid(lsp.pid, &status, WNOHANG);
+        waitpid(lsp->pid, &status, WNOHANG);
         // If still running, kill it
-        kill(lsp.pid, SIGTERM);
-        waitpid(lsp.pid, &status, 0);
+        kill(lsp->pid, SIGTERM);
+        waitpid(lsp->pid, &status, 0);
     }
 
     // Clean up buffer
-    free(lsp.read_buf);
+    free(lsp->read_buf);
 
     // Clean up pending requests
-    for (int i = 0; i < lsp.pending_count; i++) {
-        free(lsp.pending[i].uri);
+    for (int i = 0; i < lsp->pending_capacity; i++) {
+        if (lsp->pending[i].id != 0) free_pending_request(&lsp->pending[i]);
+    }
+    free(lsp->pending);
+
+    for (int i = 0; i < lsp->token_doc_count; i++) {
+        free(lsp->token_docs[i].uri);
+        free(lsp->token_docs[i].result_id);
+        free(lsp->token_docs[i].data);
     }
-    free(lsp.pending);
+    free(lsp->token_docs);
+
+    json_arena_free(lsp->in_arena);
+    json_arena_free(lsp->out_arena);
 
     // Clean up token types
-    for (int i = 0; i < lsp.token_type_count; i++) {
-        free(lsp.token_types[i]);
+    for (int i = 0; i < lsp->token_type_count; i++) {
+        free(lsp->token_types[i]);
     }
-    free(lsp.token_types);
+    free(lsp->token_types);
 
-    free(lsp.command);
-    memset(&lsp, 0, sizeof(lsp));
+    free(lsp->command);
+    memset(lsp, 0, sizeof(*lsp));
+}
+
+void lsp_shutdown(void) {
+    for (int i = 0; i < server_count; i++) {
+        stop_server(servers[i]);
+        free(servers[i]);
+    }
+    free(servers);
+    servers = NULL;
+    server_count = 0;
+    server_capacity = 0;
 }
 
 bool lsp_is_running(void) {
-    return lsp.running;
+    for (int i = 0; i < server_count; i++) {
+        if (servers[i]->running) return true;
+    }
+    return false;
 }
 
 void lsp_did_open(const char *path, const char *content, const char *language_id) {
-    if (!lsp.running || !path || !content) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp || !content) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
@@ -1016,6 +1770,7 @@ void lsp_did_open(const char *path, const char *content, const char *language_id
         language_id = "plaintext";
     }
 
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
 
@@ -1027,26 +1782,31 @@ void lsp_did_open(const char *path, const char *content, const char *language_id
     json_object_set(params, "textDocument", textDoc);
 
     JsonValue *notif = create_notification("textDocument/didOpen", params);
-    send_message(notif);
+    send_message(lsp, notif);
     json_free(notif);
+    end_message(lsp);
     free(uri);
 
     // Mark as initialized after first didOpen
-    if (!lsp.initialized) {
+    if (!lsp->initialized) {
         // Send initialized notification
+        begin_message(lsp);
         JsonValue *init_notif = create_notification("initialized", json_object());
-        send_message(init_notif);
+        send_message(lsp, init_notif);
         json_free(init_notif);
-        lsp.initialized = true;
+        end_message(lsp);
+        lsp->initialized = true;
     }
 }
 
 void lsp_did_change(const char *path, const char *content, int version) {
-    if (!lsp.running || !path || !content) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp || !content) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
 
@@ -1064,134 +1824,292 @@ void lsp_did_change(const char *path, const char *content, int version) {
     json_object_set(params, "contentChanges", changes);
 
     JsonValue *notif = create_notification("textDocument/didChange", params);
-    send_message(notif);
+    send_message_ex(lsp, notif, uri, true);
     json_free(notif);
+    end_message(lsp);
     free(uri);
 }
 
-void lsp_did_close(const char *path) {
-    if (!lsp.running || !path) return;
+static JsonValue *make_position(int line, int col) {
+    JsonValue *pos = json_object();
+    json_object_set(pos, "line", json_number(line));
+    json_object_set(pos, "character", json_number(col));
+    return pos;
+}
+
+void lsp_did_change_incremental(const char *path, const LspTextChange *changes, int count, int version) {
+    LspServer *lsp = server_for_path(path);
+    if (!lsp || !changes || count <= 0) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
 
     json_object_set(textDoc, "uri", json_string(uri));
+    json_object_set(textDoc, "version", json_number(version));
+
     json_object_set(params, "textDocument", textDoc);
 
-    JsonValue *notif = create_notification("textDocument/didClose", params);
-    send_message(notif);
+    // Incremental sync - each change is applied on top of the previous one
+    JsonValue *content_changes = json_array();
+    for (int i = 0; i < count; i++) {
+        JsonValue *range = json_object();
+        json_object_set(range, "start", make_position(changes[i].start_line, changes[i].start_col));
+        json_object_set(range, "end", make_position(changes[i].end_line, changes[i].end_col));
+
+        JsonValue *change = json_object();
+        json_object_set(change, "range", range);
+        json_object_set(change, "text", json_string(changes[i].text ? changes[i].text : ""));
+        json_array_push(content_changes, change);
+    }
+
+    json_object_set(params, "contentChanges", content_changes);
+
+    JsonValue *notif = create_notification("textDocument/didChange", params);
+    send_message_ex(lsp, notif, uri, false);
     json_free(notif);
+    end_message(lsp);
     free(uri);
 }
 
-int lsp_get_fd(void) {
-    return lsp.running ? lsp.stdout_fd : -1;
+bool lsp_incremental_sync_is_supported(const char *path) {
+    // Ranges are recorded in byte columns, which only match the server's
+    // view of the document when it counts positions in UTF-8
+    LspServer *lsp = server_for_path(path);
+    return lsp && lsp->incremental_sync && lsp->utf8_positions;
 }
 
-void lsp_process_incoming(void) {
-    if (!lsp.running) return;
+void lsp_did_close(const char *path) {
+    LspServer *lsp = server_for_path(path);
+    if (!lsp) return;
+
+    char *uri = lsp_path_to_uri(path);
+    if (!uri) return;
 
-    // Read available data
-    char tmp[4096];
+    begin_message(lsp);
+    JsonValue *params = json_object();
+    JsonValue *textDoc = json_object();
+
+    json_object_set(textDoc, "uri", json_string(uri));
+    json_object_set(params, "textDocument", textDoc);
+
+    JsonValue *notif = create_notification("textDocument/didClose", params);
+    send_message(lsp, notif);
+    json_free(notif);
+    end_message(lsp);
+    drop_token_doc(lsp, uri);
+    free(uri);
+}
+
+static void process_incoming(LspServer *lsp) {
+    // Read available data straight into the buffer's spare capacity
     while (1) {
-        ssize_t n = read(lsp.stdout_fd, tmp, sizeof(tmp));
+        if (!buf_ensure_capacity(lsp, LSP_READ_CHUNK)) return;
+        ssize_t n = read(lsp->stdout_fd, lsp->read_buf + lsp->read_buf_len,
+                         lsp->read_buf_capacity - lsp->read_buf_len - 1);
         if (n <= 0) break;
-
-        if (!buf_ensure_capacity(n)) return;
-        memcpy(lsp.read_buf + lsp.read_buf_len, tmp, n);
-        lsp.read_buf_len += n;
+        lsp->read_buf_len += n;
     }
 
     // Process complete messages
-    while (lsp.read_buf_len > 0) {
+    while (lsp->read_start < lsp->read_buf_len) {
+        char *data = lsp->read_buf + lsp->read_start;
+        int data_len = lsp->read_buf_len - lsp->read_start;
+
         // Look for Content-Length header
-        int header_pos = find_header_end(lsp.read_buf, lsp.read_buf_len);
+        int header_pos = find_header_end(data, data_len);
         if (header_pos < 0) break;
 
         int header_len = header_pos + 4;
 
         // Parse Content-Length
         int content_len = 0;
-        if (!parse_content_length(lsp.read_buf, header_pos, &content_len) || content_len <= 0) {
+        if (!parse_content_length(data, header_pos, &content_len) || content_len <= 0) {
             // Invalid message, skip header
-            memmove(lsp.read_buf, lsp.read_buf + header_len,
-                    lsp.read_buf_len - header_len);
-            lsp.read_buf_len -= header_len;
+            lsp->read_start += header_len;
             continue;
         }
 
         // Check if we have the full message
-        if (lsp.read_buf_len < header_len + content_len) break;
+        if (data_len < header_len + content_len) break;
 
         // Extract and parse JSON content
-        char *content = lsp.read_buf + header_len;
+        char *content = data + header_len;
         char saved = content[content_len];
         content[content_len] = '\0';
 
-        JsonValue *msg = json_parse(content);
+        if (!handle_semantic_tokens_raw(lsp, content)) {
+            json_use_arena(lsp->in_arena);
+            JsonValue *msg = json_parse(content);
+            json_use_arena(NULL);
+
+            // Handle the message
+            if (msg) {
+                handle_message(lsp, msg);
+                json_free(msg);
+            }
+            json_arena_reset(lsp->in_arena);
+        }
         content[content_len] = saved;
 
-        // Handle the message
-        if (msg) {
-            handle_message(msg);
-            json_free(msg);
+        // Step past the processed message
+        lsp->read_start += header_len + content_len;
+    }
+
+    // Once everything is handled, start over at the front for free
+    if (lsp->read_start == lsp->read_buf_len) {
+        lsp->read_start = 0;
+        lsp->read_buf_len = 0;
+    }
+}
+
+// Add every server's stdout to readfds, and its stdin to writefds while
+// messages are waiting to be written. Returns the new highest fd.
+int lsp_add_fds(fd_set *readfds, fd_set *writefds, int max_fd) {
+    for (int i = 0; i < server_count; i++) {
+        LspServer *lsp = servers[i];
+        if (!lsp->running) continue;
+        FD_SET(lsp->stdout_fd, readfds);
+        if (lsp->stdout_fd > max_fd) max_fd = lsp->stdout_fd;
+        if (lsp->out_head < lsp->out_count) {
+            FD_SET(lsp->stdin_fd, writefds);
+            if (lsp->stdin_fd > max_fd) max_fd = lsp->stdin_fd;
         }
+    }
+    return max_fd;
+}
 
-        // Remove processed message from buffer
-        int total_len = header_len + content_len;
-        memmove(lsp.read_buf, lsp.read_buf + total_len,
-                lsp.read_buf_len - total_len);
-        lsp.read_buf_len -= total_len;
+// Cancel requests the servers have not answered in time
+void lsp_process_timeouts(void) {
+    for (int i = 0; i < server_count; i++) {
+        if (servers[i]->running) expire_pending_requests(servers[i]);
+    }
+}
+
+// Flush and read the servers select() reported ready. Returns true if any
+// input was handled.
+bool lsp_process_fds(fd_set *readfds, fd_set *writefds) {
+    bool handled = false;
+    for (int i = 0; i < server_count; i++) {
+        LspServer *lsp = servers[i];
+        if (!lsp->running) continue;
+        if (FD_ISSET(lsp->stdin_fd, writefds)) {
+            flush_out_queue(lsp);
+        }
+        if (FD_ISSET(lsp->stdout_fd, readfds)) {
+            process_incoming(lsp);
+            handled = true;
+        }
     }
+    return handled;
 }
 
 void lsp_set_diagnostics_callback(lsp_diagnostics_callback cb) {
-    lsp.diagnostics_cb = cb;
+    callbacks.diagnostics_cb = cb;
 }
 
 void lsp_set_semantic_tokens_callback(lsp_semantic_tokens_callback cb) {
-    lsp.semantic_cb = cb;
+    callbacks.semantic_cb = cb;
 }
 
 void lsp_set_hover_callback(lsp_hover_callback cb) {
-    lsp.hover_cb = cb;
+    callbacks.hover_cb = cb;
 }
 
 void lsp_set_completion_callback(lsp_completion_callback cb) {
-    lsp.completion_cb = cb;
+    callbacks.completion_cb = cb;
 }
 
 void lsp_request_semantic_tokens(const char *path) {
-    if (!lsp.running || !path) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    cancel_superseded_requests(lsp, REQ_SEMANTIC_TOKENS, uri);
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
 
     json_object_set(textDoc, "uri", json_string(uri));
     json_object_set(params, "textDocument", textDoc);
 
-    JsonValue *req = create_request("textDocument/semanticTokens/full", params);
+    // Ask only for the changes since the last result when the server can
+    SemanticTokenDoc *doc = lsp->semantic_delta ? find_token_doc(lsp, uri, false) : NULL;
+    const char *base_id = doc ? doc->result_id : NULL;
+    const char *method = "textDocument/semanticTokens/full";
+    if (base_id) {
+        json_object_set(params, "previousResultId", json_string(base_id));
+        method = "textDocument/semanticTokens/full/delta";
+    }
+
+    JsonValue *req = create_request(lsp, method, params);
 
     // Track this request so we can match the response
-    add_pending_request(lsp.request_id, uri, REQ_SEMANTIC_TOKENS, -1, -1);
+    PendingRequest *pending = add_pending_request(lsp, lsp->request_id, uri, REQ_SEMANTIC_TOKENS, -1, -1);
+    if (pending && base_id) pending->base_result_id = strdup(base_id);
 
-    send_message(req);
+    send_message(lsp, req);
     json_free(req);
+    end_message(lsp);
     free(uri);
 }
 
+void lsp_set_semantic_tokens_range_callback(lsp_semantic_tokens_range_callback cb) {
+    callbacks.semantic_range_cb = cb;
+}
+
+// Tokens for lines start_line..end_line only, e.g. the visible part of a
+// large file before the full result arrives
+void lsp_request_semantic_tokens_range(const char *path, int start_line, int end_line) {
+    LspServer *lsp = server_for_path(path);
+    if (!lsp || !lsp->semantic_range) return;
+
+    char *uri = lsp_path_to_uri(path);
+    if (!uri) return;
+
+    cancel_superseded_requests(lsp, REQ_SEMANTIC_TOKENS_RANGE, uri);
+    begin_message(lsp);
+    JsonValue *params = json_object();
+    JsonValue *textDoc = json_object();
+    json_object_set(textDoc, "uri", json_string(uri));
+    json_object_set(params, "textDocument", textDoc);
+
+    JsonValue *range = json_object();
+    json_object_set(range, "start", make_position(start_line, 0));
+    json_object_set(range, "end", make_position(end_line + 1, 0));
+    json_object_set(params, "range", range);
+
+    JsonValue *req = create_request(lsp, "textDocument/semanticTokens/range", params);
+
+    PendingRequest *pending = add_pending_request(lsp, lsp->request_id, uri, REQ_SEMANTIC_TOKENS_RANGE,
+                                                  start_line, -1);
+    if (pending) pending->end_line = end_line;
+
+    send_message(lsp, req);
+    json_free(req);
+    end_message(lsp);
+    free(uri);
+}
+
+bool lsp_semantic_tokens_range_is_supported(const char *path) {
+    LspServer *lsp = server_for_path(path);
+    return lsp && lsp->semantic_range;
+}
+
 void lsp_request_hover(const char *path, int line, int col) {
-    if (!lsp.running || !path) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    cancel_superseded_requests(lsp, REQ_HOVER, NULL);
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
     JsonValue *pos = json_object();
@@ -1202,21 +2120,25 @@ void lsp_request_hover(const char *path, int line, int col) {
     json_object_set(params, "textDocument", textDoc);
     json_object_set(params, "position", pos);
 
-    JsonValue *req = create_request("textDocument/hover", params);
+    JsonValue *req = create_request(lsp, "textDocument/hover", params);
 
-    add_pending_request(lsp.request_id, uri, REQ_HOVER, line, col);
+    add_pending_request(lsp, lsp->request_id, uri, REQ_HOVER, line, col);
 
-    send_message(req);
+    send_message(lsp, req);
     json_free(req);
+    end_message(lsp);
     free(uri);
 }
 
 void lsp_request_completion(const char *path, int line, int col, const char *trigger, int trigger_kind) {
-    if (!lsp.running || !path) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp) return;
 
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    cancel_superseded_requests(lsp, REQ_COMPLETION, NULL);
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
     JsonValue *pos = json_object();
@@ -1237,26 +2159,31 @@ void lsp_request_completion(const char *path, int line, int col, const char *tri
     }
     json_object_set(params, "context", context);
 
-    JsonValue *req = create_request("textDocument/completion", params);
-    add_pending_request(lsp.request_id, uri, REQ_COMPLETION, line, col);
-    send_message(req);
+    JsonValue *req = create_request(lsp, "textDocument/completion", params);
+    add_pending_request(lsp, lsp->request_id, uri, REQ_COMPLETION, line, col);
+    send_message(lsp, req);
     json_free(req);
+    end_message(lsp);
     free(uri);
 }
 
-bool lsp_hover_is_supported(void) {
-    return lsp.hover_supported;
+bool lsp_hover_is_supported(const char *path) {
+    LspServer *lsp = server_for_path(path);
+    return lsp && lsp->hover_supported;
 }
 
 void lsp_set_type_definition_callback(lsp_type_definition_callback cb) {
-    lsp.type_def_cb = cb;
+    callbacks.type_def_cb = cb;
 }
 
 void lsp_request_type_definition(const char *path, int line, int col) {
-    if (!lsp.running || !path) return;
+    LspServer *lsp = server_for_path(path);
+    if (!lsp) return;
     char *uri = lsp_path_to_uri(path);
     if (!uri) return;
 
+    cancel_superseded_requests(lsp, REQ_TYPE_DEFINITION, NULL);
+    begin_message(lsp);
     JsonValue *params = json_object();
     JsonValue *textDoc = json_object();
     JsonValue *position = json_object();
@@ -1266,24 +2193,22 @@ void lsp_request_type_definition(const char *path, int line, int col) {
     json_object_set(params, "textDocument", textDoc);
     json_object_set(params, "position", position);
 
-    JsonValue *msg = json_object();
-    json_object_set(msg, "jsonrpc", json_string("2.0"));
-    json_object_set(msg, "id", json_number(++lsp.request_id));
-    json_object_set(msg, "method", json_string("textDocument/typeDefinition"));
-    json_object_set(msg, "params", params);
+    JsonValue *req = create_request(lsp, "textDocument/typeDefinition", params);
 
-    int id = lsp.request_id;
-    if (send_message(msg)) {
-        add_pending_request(id, uri, REQ_TYPE_DEFINITION, line, col);
-    }
-    json_free(msg);
+    add_pending_request(lsp, lsp->request_id, uri, REQ_TYPE_DEFINITION, line, col);
+
+    send_message(lsp, req);
+    json_free(req);
+    end_message(lsp);
     free(uri);
 }
 
-bool lsp_type_definition_is_supported(void) {
-    return lsp.type_def_supported;
+bool lsp_type_definition_is_supported(const char *path) {
+    LspServer *lsp = server_for_path(path);
+    return lsp && lsp->type_def_supported;
 }
 
-bool lsp_completion_is_supported(void) {
-    return lsp.completion_supported;
+bool lsp_completion_is_supported(const char *path) {
+    LspServer *lsp = server_for_path(path);
+    return lsp && lsp->completion_supported;
 }
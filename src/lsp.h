@@ -2,6 +2,7 @@
 #define LSP_H
 
 #include <stdbool.h>
+#include <sys/select.h>
 
 // Diagnostic severity levels (LSP spec)
 typedef enum {
@@ -65,11 +66,24 @@ typedef struct {
 
 // Callback for semantic tokens
 typedef void (*lsp_semantic_tokens_callback)(const char *uri, SemanticToken *tokens, int count);
+// Callback for tokens covering only lines start_line..end_line
+typedef void (*lsp_semantic_tokens_range_callback)(const char *uri, SemanticToken *tokens, int count,
+                                                   int start_line, int end_line);
 
 // Callback for hover info
 typedef void (*lsp_hover_callback)(const char *uri, int line, int col, const char *text);
 typedef void (*lsp_type_definition_callback)(const char *uri, int line, int col);
 
+// Single incremental document change, in the coordinates of the document
+// before the change is applied
+typedef struct {
+    int start_line;
+    int start_col;
+    int end_line;
+    int end_col;
+    const char *text;
+} LspTextChange;
+
 // Completion item
 typedef struct {
     char *label;
@@ -81,19 +95,23 @@ typedef struct {
 typedef void (*lsp_completion_callback)(const char *uri, int line, int col,
                                         LspCompletionItem *items, int count);
 
-// Lifecycle
-bool lsp_init(const char *command);  // Spawn LSP server with given command
-void lsp_shutdown(void);
+// Lifecycle. One server runs per command; requests for a file go to the
+// server configured for its extension.
+bool lsp_init(const char *command);  // Spawn LSP server with given command unless running
+void lsp_shutdown(void);             // Stop all servers
 bool lsp_is_running(void);
 
 // Document sync
 void lsp_did_open(const char *path, const char *content, const char *language_id);
 void lsp_did_change(const char *path, const char *content, int version);
+void lsp_did_change_incremental(const char *path, const LspTextChange *changes, int count, int version);
+bool lsp_incremental_sync_is_supported(const char *path);
 void lsp_did_close(const char *path);
 
 // Polling (call from event loop)
-int lsp_get_fd(void);
-void lsp_process_incoming(void);
+int lsp_add_fds(fd_set *readfds, fd_set *writefds, int max_fd);
+bool lsp_process_fds(fd_set *readfds, fd_set *writefds);
+void lsp_process_timeouts(void);
 
 // Diagnostics callback
 void lsp_set_diagnostics_callback(lsp_diagnostics_callback cb);
@@ -101,19 +119,22 @@ void lsp_set_diagnostics_callback(lsp_diagnostics_callback cb);
 // Semantic tokens
 void lsp_set_semantic_tokens_callback(lsp_semantic_tokens_callback cb);
 void lsp_request_semantic_tokens(const char *path);
+void lsp_set_semantic_tokens_range_callback(lsp_semantic_tokens_range_callback cb);
+void lsp_request_semantic_tokens_range(const char *path, int start_line, int end_line);
+bool lsp_semantic_tokens_range_is_supported(const char *path);
 
 // Hover
 void lsp_set_hover_callback(lsp_hover_callback cb);
 void lsp_request_hover(const char *path, int line, int col);
-bool lsp_hover_is_supported(void);
+bool lsp_hover_is_supported(const char *path);
 void lsp_set_type_definition_callback(lsp_type_definition_callback cb);
 void lsp_request_type_definition(const char *path, int line, int col);
-bool lsp_type_definition_is_supported(void);
+bool lsp_type_definition_is_supported(const char *path);
 
 // Completion
 void lsp_set_completion_callback(lsp_completion_callback cb);
 void lsp_request_completion(const char *path, int line, int col, const char *trigger, int trigger_kind);
-bool lsp_completion_is_supported(void);
+bool lsp_completion_is_supported(const char *path);
 
 // Helper to convert file path to URI
 char *lsp_path_to_uri(const char *path);
@@ -23,24 +23,20 @@ static long long monotonic_ms(void) {
 char *get_buffer_content(TextBuffer *buffer) {
     if (!buffer || buffer->line_count <= 0) return NULL;
 
-    int total_size = 0;
+    size_t total_size = 0;
     for (int i = 0; i < buffer->line_count; i++) {
-        if (buffer->lines[i]) {
-            total_size += strlen(buffer->lines[i]);
-        }
+        total_size += buffer_line_length(buffer, i);
         total_size++; // For newline
     }
 
     char *content = malloc(total_size + 1);
     if (!content) return NULL;
 
-    int pos = 0;
+    size_t pos = 0;
     for (int i = 0; i < buffer->line_count; i++) {
-        if (buffer->lines[i]) {
-            int len = strlen(buffer->lines[i]);
-            memcpy(content + pos, buffer->lines[i], len);
-            pos += len;
-        }
+        int len = buffer_line_length(buffer, i);
+        memcpy(content + pos, buffer_get_line(buffer, i), len);
+        pos += len;
         content[pos++] = '\n';
     }
     content[pos] = '\0';
@@ -60,36 +56,98 @@ void clear_tab_diagnostics(Tab *tab) {
     }
     tab->diagnostic_count = 0;
     tab->diagnostic_capacity = 0;
+    free(tab->diagnostic_line_start);
+    free(tab->diagnostic_line_count);
+    tab->diagnostic_line_start = NULL;
+    tab->diagnostic_line_count = NULL;
+    tab->diagnostic_line_capacity = 0;
 }
 
-DiagnosticSeverity get_line_diagnostic_severity(Tab *tab, int line) {
-    if (!tab || !tab->diagnostics) return 0;
+// Group diagnostics by line, keeping the server's order within a line, and
+// index where each line's group starts
+static void build_diagnostic_line_index(Tab *tab) {
+    if (!tab || !tab->buffer || tab->diagnostic_count == 0 || !tab->diagnostics) return;
+
+    int line_count = tab->buffer->line_count;
+    if (line_count <= 0) return;
+
+    if (tab->diagnostic_line_capacity < line_count) {
+        int *new_start = malloc(sizeof(int) * line_count);
+        int *new_count = malloc(sizeof(int) * line_count);
+        if (!new_start || !new_count) {
+            free(new_start);
+            free(new_count);
+            return;
+        }
+        free(tab->diagnostic_line_start);
+        free(tab->diagnostic_line_count);
+        tab->diagnostic_line_start = new_start;
+        tab->diagnostic_line_count = new_count;
+        tab->diagnostic_line_capacity = line_count;
+    }
+
+    LineDiagnostic *sorted = malloc(sizeof(LineDiagnostic) * tab->diagnostic_count);
+    if (!sorted) return;
+
+    for (int i = 0; i < line_count; i++) {
+        tab->diagnostic_line_count[i] = 0;
+    }
+    int outside = 0;
+    for (int i = 0; i < tab->diagnostic_count; i++) {
+        int line = tab->diagnostics[i].line;
+        if (line < 0 || line >= line_count) outside++;
+        else tab->diagnostic_line_count[line]++;
+    }
 
-    DiagnosticSeverity worst = 0;
+    // Diagnostics on lines past the end are kept after the indexed ones
+    int pos = 0;
+    for (int i = 0; i < line_count; i++) {
+        tab->diagnostic_line_start[i] = tab->diagnostic_line_count[i] > 0 ? pos : -1;
+        pos += tab->diagnostic_line_count[i];
+        tab->diagnostic_line_count[i] = 0;
+    }
+    int next_outside = tab->diagnostic_count - outside;
     for (int i = 0; i < tab->diagnostic_count; i++) {
-        if (tab->diagnostics[i].line == line) {
-            if (worst == 0 || tab->diagnostics[i].severity < worst) {
-                worst = tab->diagnostics[i].severity;
-            }
+        int line = tab->diagnostics[i].line;
+        if (line < 0 || line >= line_count) {
+            sorted[next_outside++] = tab->diagnostics[i];
+        } else {
+            int start = tab->diagnostic_line_start[line];
+            sorted[start + tab->diagnostic_line_count[line]] = tab->diagnostics[i];
+            tab->diagnostic_line_count[line]++;
         }
     }
-    return worst;
+    free(tab->diagnostics);
+    tab->diagnostics = sorted;
+    tab->diagnostic_capacity = tab->diagnostic_count;
 }
 
-const char *get_line_diagnostic_message(Tab *tab, int line) {
-    if (!tab || !tab->diagnostics) return NULL;
+// Most severe diagnostic on a line (the first one on ties), or NULL
+static const LineDiagnostic *get_line_worst_diagnostic(Tab *tab, int line) {
+    if (!tab || !tab->diagnostics || !tab->diagnostic_line_start) return NULL;
+    if (line < 0 || line >= tab->diagnostic_line_capacity) return NULL;
 
-    const char *msg = NULL;
-    DiagnosticSeverity worst = 0;
-    for (int i = 0; i < tab->diagnostic_count; i++) {
-        if (tab->diagnostics[i].line == line) {
-            if (worst == 0 || tab->diagnostics[i].severity < worst) {
-                worst = tab->diagnostics[i].severity;
-                msg = tab->diagnostics[i].message;
-            }
+    int start = tab->diagnostic_line_start[line];
+    int count = tab->diagnostic_line_count[line];
+    if (start < 0 || count <= 0) return NULL;
+
+    const LineDiagnostic *worst = NULL;
+    for (int i = start; i < start + count; i++) {
+        if (!worst || worst->severity == 0 || tab->diagnostics[i].severity < worst->severity) {
+            worst = &tab->diagnostics[i];
         }
     }
-    return msg;
+    return worst;
+}
+
+DiagnosticSeverity get_line_diagnostic_severity(Tab *tab, int line) {
+    const LineDiagnostic *diag = get_line_worst_diagnostic(tab, line);
+    return diag ? diag->severity : 0;
+}
+
+const char *get_line_diagnostic_message(Tab *tab, int line) {
+    const LineDiagnostic *diag = get_line_worst_diagnostic(tab, line);
+    return diag ? diag->message : NULL;
 }
 
 void lsp_diagnostics_handler(const char *uri, Diagnostic *diags, int count) {
@@ -150,6 +208,7 @@ void lsp_diagnostics_handler(const char *uri, Diagnostic *diags, int count) {
         }
         tab->diagnostic_count++;
     }
+    build_diagnostic_line_index(tab);
 
     editor.needs_full_redraw = true;
 }
@@ -173,22 +232,24 @@ void notify_lsp_file_opened(Tab *tab) {
         tab->lsp_name = strdup(cfg->name);
     }
 
-    // Initialize (or restart) LSP server for this language
-    editor.lsp_enabled = lsp_init(command);
-    if (editor.lsp_enabled) {
+    // Start the server for this language if it is not running yet; servers
+    // of other languages stay up for their tabs
+    if (!lsp_init(command)) return;
+    if (!editor.lsp_enabled) {
+        editor.lsp_enabled = true;
         lsp_set_diagnostics_callback(lsp_diagnostics_handler);
         lsp_set_semantic_tokens_callback(lsp_semantic_tokens_handler);
+        lsp_set_semantic_tokens_range_callback(lsp_semantic_tokens_range_handler);
         lsp_set_hover_callback(lsp_hover_handler);
         lsp_set_type_definition_callback(lsp_type_definition_handler);
         lsp_set_completion_callback(lsp_completion_handler);
-    } else {
-        return;
     }
 
     char *content = get_buffer_content(tab->buffer);
     if (content) {
         lsp_did_open(tab->filename, content, cfg->name);
         free(content);
+        buffer_reset_edits(tab->buffer);
         tab->lsp_opened = true;
         tab->lsp_version = 1;
 
@@ -197,15 +258,70 @@ void notify_lsp_file_opened(Tab *tab) {
     }
 }
 
-void notify_lsp_file_changed(Tab *tab) {
-    if (!editor.lsp_enabled || !tab || !tab->filename || !tab->lsp_opened) return;
+static bool send_incremental_changes(Tab *tab) {
+    TextBuffer *buffer = tab->buffer;
+    if (!buffer->edits_valid || !lsp_incremental_sync_is_supported(tab->filename)) return false;
+    if (buffer->edit_count == 0) return true;
+
+    LspTextChange *changes = malloc(sizeof(LspTextChange) * buffer->edit_count);
+    if (!changes) return false;
+
+    for (int i = 0; i < buffer->edit_count; i++) {
+        BufferEdit *edit = &buffer->edits[i];
+        changes[i].start_line = edit->start_row;
+        changes[i].start_col = edit->start_col;
+        changes[i].end_line = edit->end_row;
+        changes[i].end_col = edit->end_col;
+        changes[i].text = edit->text;
+    }
 
-    char *content = get_buffer_content(tab->buffer);
-    if (content) {
+    tab->lsp_version++;
+    lsp_did_change_incremental(tab->filename, changes, buffer->edit_count, tab->lsp_version);
+    free(changes);
+    return true;
+}
+
+void flush_lsp_changes(Tab *tab) {
+    if (!tab || !tab->lsp_change_pending) return;
+    if (!editor.lsp_enabled || !tab->filename || !tab->lsp_opened) {
+        tab->lsp_change_pending = false;
+        return;
+    }
+
+    // Send the recorded edit ranges when the server takes them, otherwise
+    // fall back to the full text
+    if (!send_incremental_changes(tab)) {
+        char *content = get_buffer_content(tab->buffer);
+        if (!content) return;
         tab->lsp_version++;
         lsp_did_change(tab->filename, content, tab->lsp_version);
         free(content);
-        schedule_semantic_tokens(tab);
+    }
+    buffer_reset_edits(tab->buffer);
+    tab->lsp_change_pending = false;
+    tab->lsp_last_sync_ms = monotonic_ms();
+}
+
+void notify_lsp_file_changed(Tab *tab) {
+    if (!editor.lsp_enabled || !tab || !tab->filename || !tab->lsp_opened) return;
+
+    // Queue the change; the first edit after a quiet period goes out right
+    // away, edits within the interval are coalesced into the next flush
+    tab->lsp_change_pending = true;
+    if (monotonic_ms() - tab->lsp_last_sync_ms >= editor_config_get_lsp_change_delay_ms()) {
+        flush_lsp_changes(tab);
+    }
+    schedule_semantic_tokens(tab);
+}
+
+void process_lsp_changes(void) {
+    if (!editor.lsp_enabled) return;
+    int delay = editor_config_get_lsp_change_delay_ms();
+    for (int i = 0; i < editor.tab_count; i++) {
+        Tab *tab = &editor.tabs[i];
+        if (!tab->lsp_change_pending) continue;
+        if (monotonic_ms() - tab->lsp_last_sync_ms < delay) continue;
+        flush_lsp_changes(tab);
     }
 }
 
@@ -215,6 +331,7 @@ void notify_lsp_file_closed(Tab *tab) {
     lsp_did_close(tab->filename);
     tab->lsp_opened = false;
     tab->lsp_version = 1;
+    tab->lsp_change_pending = false;
     if (tab->lsp_name) {
         free(tab->lsp_name);
         tab->lsp_name = NULL;
@@ -278,42 +395,290 @@ static void build_token_line_index(Tab *tab) {
     }
 }
 
-void lsp_semantic_tokens_handler(const char *uri, SemanticToken *tokens, int count) {
-    if (!uri) return;
+static bool get_token_line_range(Tab *tab, int line, int *start, int *end) {
+    if (!tab || !tab->tokens || !tab->token_line_start || !tab->token_line_count) return false;
+    if (line < 0 || line >= tab->token_line_capacity) return false;
+    if (tab->token_line_start[line] < 0 || tab->token_line_count[line] <= 0) return false;
+    *start = tab->token_line_start[line];
+    *end = *start + tab->token_line_count[line];
+    return true;
+}
+
+void token_cursor_init(TokenCursor *cursor, Tab *tab, int line) {
+    cursor->tokens = tab ? tab->tokens : NULL;
+    cursor->pos = 0;
+    cursor->end = 0;
+    get_token_line_range(tab, line, &cursor->pos, &cursor->end);
+}
+
+// First token that ends after col: it covers col if it starts at or before
+// it, otherwise it is the next token to the right. col must not decrease
+// between calls.
+const StoredToken *token_cursor_next(TokenCursor *cursor, int col) {
+    while (cursor->pos < cursor->end &&
+           cursor->tokens[cursor->pos].col + cursor->tokens[cursor->pos].length <= col) {
+        cursor->pos++;
+    }
+    return cursor->pos < cursor->end ? &cursor->tokens[cursor->pos] : NULL;
+}
+
+// Bring the token line index in line with tokens shifted by an edit: lines
+// before the edit keep their entries, lines after it move by the line delta
+// and lose the removed tokens from their start, and the edited lines are
+// recounted from the first token at or after start_line
+static void shift_token_line_index(Tab *tab, int start_line, int old_end_line, int new_end_line,
+                                   int first, int removed) {
+    if (!tab->token_line_start || !tab->token_line_count) return;
+
+    int old_capacity = tab->token_line_capacity;
+    int line_delta = new_end_line - old_end_line;
+    int old_line_count = tab->buffer->line_count - line_delta;
+    int tail_from = old_end_line + 1;
+    int tail_limit = old_line_count < old_capacity ? old_line_count : old_capacity;
+    int tail_len = tail_limit > tail_from ? tail_limit - tail_from : 0;
+    int needed = tab->buffer->line_count > new_end_line + 1 ? tab->buffer->line_count : new_end_line + 1;
+
+    if (needed > old_capacity) {
+        int new_capacity = old_capacity * 2 > needed ? old_capacity * 2 : needed;
+        int *new_start = realloc(tab->token_line_start, sizeof(int) * new_capacity);
+        if (!new_start) {
+            clear_tab_tokens(tab);
+            return;
+        }
+        tab->token_line_start = new_start;
+        int *new_count = realloc(tab->token_line_count, sizeof(int) * new_capacity);
+        if (!new_count) {
+            clear_tab_tokens(tab);
+            return;
+        }
+        tab->token_line_count = new_count;
+        for (int i = old_capacity; i < new_capacity; i++) {
+            tab->token_line_start[i] = -1;
+            tab->token_line_count[i] = 0;
+        }
+        tab->token_line_capacity = new_capacity;
+    }
+
+    if (tail_len > 0 && line_delta != 0) {
+        memmove(tab->token_line_start + tail_from + line_delta, tab->token_line_start + tail_from,
+                sizeof(int) * tail_len);
+        memmove(tab->token_line_count + tail_from + line_delta, tab->token_line_count + tail_from,
+                sizeof(int) * tail_len);
+    }
+    int tail_end = new_end_line + 1 + tail_len;
+    if (removed > 0) {
+        for (int i = new_end_line + 1; i < tail_end; i++) {
+            if (tab->token_line_start[i] >= 0) tab->token_line_start[i] -= removed;
+        }
+    }
+    // Entries vacated by a shift towards the front
+    for (int i = tail_end; i < tail_from + tail_len; i++) {
+        tab->token_line_start[i] = -1;
+        tab->token_line_count[i] = 0;
+    }
+
+    for (int i = start_line; i <= new_end_line; i++) {
+        tab->token_line_start[i] = -1;
+        tab->token_line_count[i] = 0;
+    }
+    for (int i = first; i < tab->token_count && tab->tokens[i].line <= new_end_line; i++) {
+        int line = tab->tokens[i].line;
+        if (tab->token_line_start[line] == -1) {
+            tab->token_line_start[line] = i;
+        }
+        tab->token_line_count[line]++;
+    }
+}
+
+static void shift_tokens(Tab *tab, int start_line, int start_col, int old_end_line, int old_end_col,
+                         int new_end_line, int new_end_col) {
+    if (!tab->tokens || tab->token_count == 0) return;
+
+    bool single_line = start_line == old_end_line && start_line == new_end_line;
+    int line_delta = new_end_line - old_end_line;
+    int col_delta = new_end_col - old_end_col;
+
+    // Tokens are sorted by position; find the first on or after start_line
+    int lo = 0;
+    int hi = tab->token_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->tokens[mid].line < start_line) lo = mid + 1;
+        else hi = mid;
+    }
+    int first = lo;
+
+    int out = first;
+    for (int i = first; i < tab->token_count; i++) {
+        StoredToken tok = tab->tokens[i];
+        int tok_end = tok.col + tok.length;
+        if (tok.line == start_line && tok_end <= start_col) {
+            // Before the edit
+        } else if (tok.line > old_end_line || (tok.line == old_end_line && tok.col >= old_end_col)) {
+            // After the edit
+            if (tok.line == old_end_line) {
+                tok.col += new_end_col - old_end_col;
+            }
+            tok.line += line_delta;
+        } else if (single_line && tok.col < start_col && old_end_col < tok_end &&
+                   tok.length + col_delta > 0) {
+            // Typing inside a token grows or shrinks it
+            tok.length += col_delta;
+        } else {
+            continue;
+        }
+        tab->tokens[out++] = tok;
+    }
+    int removed = tab->token_count - out;
+    tab->token_count = out;
+
+    shift_token_line_index(tab, start_line, old_end_line, new_end_line, first, removed);
+}
+
+static void shift_diagnostics(Tab *tab, int start_line, int old_end_line, int new_end_line) {
+    if (!tab->diagnostics || tab->diagnostic_count == 0) return;
+    // Diagnostics only carry a line, so edits within a line leave them alone
+    if (start_line == old_end_line && start_line == new_end_line) return;
+
+    int line_delta = new_end_line - old_end_line;
+    int out = 0;
+    for (int i = 0; i < tab->diagnostic_count; i++) {
+        LineDiagnostic diag = tab->diagnostics[i];
+        if (diag.line > old_end_line) {
+            diag.line += line_delta;
+        } else if (diag.line == old_end_line && diag.line > start_line) {
+            // The rest of the last edited line now ends the inserted text
+            diag.line = new_end_line;
+        } else if (diag.line > start_line) {
+            // The line was deleted
+            free(diag.message);
+            free(diag.source);
+            continue;
+        }
+        tab->diagnostics[out++] = diag;
+    }
+    tab->diagnostic_count = out;
+
+    if (out == 0) {
+        clear_tab_diagnostics(tab);
+        return;
+    }
+    build_diagnostic_line_index(tab);
+}
+
+// The text between (start_line, start_col) and (old_end_line, old_end_col)
+// was replaced by text ending at (new_end_line, new_end_col). Move tokens and
+// diagnostics with the text around them and drop the ones inside the edit,
+// so highlighting stays in place until the server sends fresh results.
+void shift_lsp_annotations(Tab *tab, int start_line, int start_col,
+                           int old_end_line, int old_end_col,
+                           int new_end_line, int new_end_col) {
+    if (!tab || !tab->buffer) return;
+    shift_tokens(tab, start_line, start_col, old_end_line, old_end_col, new_end_line, new_end_col);
+    shift_diagnostics(tab, start_line, old_end_line, new_end_line);
+}
+
+static Tab *find_tab_for_uri(const char *uri) {
+    if (!uri) return NULL;
 
     // Convert URI to path
     char *path = lsp_uri_to_path(uri);
-    if (!path) return;
+    if (!path) return NULL;
 
     // Find the tab with this file
     int tab_idx = find_tab_with_file(path);
     free(path);
 
-    if (tab_idx < 0) return;
+    return tab_idx < 0 ? NULL : &editor.tabs[tab_idx];
+}
 
-    Tab *tab = &editor.tabs[tab_idx];
+// Keep the token array across responses and only grow it when needed
+static bool reserve_tab_tokens(Tab *tab, int count) {
+    if (count <= tab->token_capacity) return true;
+    int new_capacity = tab->token_capacity == 0 ? count : tab->token_capacity * 2;
+    if (new_capacity < count) new_capacity = count;
+    StoredToken *new_tokens = realloc(tab->tokens, new_capacity * sizeof(StoredToken));
+    if (!new_tokens) return false;
+    tab->tokens = new_tokens;
+    tab->token_capacity = new_capacity;
+    return true;
+}
 
-    // Clear old tokens
-    clear_tab_tokens(tab);
+static void store_token(StoredToken *dst, const SemanticToken *src) {
+    dst->line = src->line;
+    dst->col = src->col;
+    dst->length = src->length;
+    dst->type = src->type;
+}
+
+void lsp_semantic_tokens_handler(const char *uri, SemanticToken *tokens, int count) {
+    Tab *tab = find_tab_for_uri(uri);
+    if (!tab) return;
 
     if (count == 0 || !tokens) {
+        clear_tab_tokens(tab);
         editor.needs_full_redraw = true;
         return;
     }
 
-    // Store new tokens
-    tab->tokens = calloc(count, sizeof(StoredToken));
-    if (!tab->tokens) return;
-
-    tab->token_capacity = count;
+    if (!reserve_tab_tokens(tab, count)) {
+        clear_tab_tokens(tab);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        store_token(&tab->tokens[i], &tokens[i]);
+    }
     tab->token_count = count;
 
+    build_token_line_index(tab);
+
+    editor.needs_full_redraw = true;
+}
+
+// First token at or after line
+static int lower_bound_token_line(Tab *tab, int line) {
+    int lo = 0;
+    int hi = tab->token_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (tab->tokens[mid].line < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Replace the tokens of lines start_line..end_line, keeping the rest
+void lsp_semantic_tokens_range_handler(const char *uri, SemanticToken *tokens, int count,
+                                       int start_line, int end_line) {
+    Tab *tab = find_tab_for_uri(uri);
+    if (!tab) return;
+
+    int incoming = 0;
     for (int i = 0; i < count; i++) {
-        tab->tokens[i].line = tokens[i].line;
-        tab->tokens[i].col = tokens[i].col;
-        tab->tokens[i].length = tokens[i].length;
-        tab->tokens[i].type = tokens[i].type;
+        if (tokens[i].line >= start_line && tokens[i].line <= end_line) incoming++;
+    }
+
+    int lo = lower_bound_token_line(tab, start_line);
+    int hi = lower_bound_token_line(tab, end_line + 1);
+    int new_count = tab->token_count - (hi - lo) + incoming;
+    if (new_count == 0) {
+        clear_tab_tokens(tab);
+        editor.needs_full_redraw = true;
+        return;
     }
+    if (!reserve_tab_tokens(tab, new_count)) return;
+
+    memmove(tab->tokens + lo + incoming, tab->tokens + hi,
+            (tab->token_count - hi) * sizeof(StoredToken));
+    int pos = lo;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].line < start_line || tokens[i].line > end_line) continue;
+        store_token(&tab->tokens[pos++], &tokens[i]);
+    }
+    tab->token_count = new_count;
 
     build_token_line_index(tab);
 
@@ -322,6 +687,15 @@ void lsp_semantic_tokens_handler(const char *uri, SemanticToken *tokens, int cou
 
 void request_semantic_tokens(Tab *tab) {
     if (!editor.lsp_enabled || !tab || !tab->filename || !tab->lsp_opened) return;
+    flush_lsp_changes(tab);
+
+    // Before the first full result of a large file, get the visible lines
+    // highlighted quickly
+    if (tab->token_count == 0 && tab->buffer->line_count > editor.screen_rows &&
+        lsp_semantic_tokens_range_is_supported(tab->filename)) {
+        lsp_request_semantic_tokens_range(tab->filename, tab->offset_y,
+                                          tab->offset_y + editor.screen_rows - 1);
+    }
     lsp_request_semantic_tokens(tab->filename);
 }
 
@@ -12,15 +12,24 @@ void clear_tab_tokens(Tab *tab);
 
 void lsp_diagnostics_handler(const char *uri, Diagnostic *diags, int count);
 void lsp_semantic_tokens_handler(const char *uri, SemanticToken *tokens, int count);
+void lsp_semantic_tokens_range_handler(const char *uri, SemanticToken *tokens, int count,
+                                       int start_line, int end_line);
 
 void notify_lsp_file_opened(Tab *tab);
 void notify_lsp_file_changed(Tab *tab);
+void flush_lsp_changes(Tab *tab);
+void process_lsp_changes(void);
 void notify_lsp_file_closed(Tab *tab);
+void shift_lsp_annotations(Tab *tab, int start_line, int start_col,
+                           int old_end_line, int old_end_col,
+                           int new_end_line, int new_end_col);
 
 void request_semantic_tokens(Tab *tab);
 void schedule_semantic_tokens(Tab *tab);
 void process_semantic_tokens_requests(void);
 
 const char *get_token_color(SemanticTokenType type);
+void token_cursor_init(TokenCursor *cursor, Tab *tab, int line);
+const StoredToken *token_cursor_next(TokenCursor *cursor, int col);
 
 #endif
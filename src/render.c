@@ -1,18 +1,32 @@
 #define _GNU_SOURCE
 #include "render.h"
 #include "editor.h"
+#include "editor_folds.h"
 #include "file_manager.h"
 #include "terminal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 
 static void draw_modal(RenderBuf *rb, const char* title, const char* message, const char* bg_color, const char* fg_color);
 static void draw_completion_popup(RenderBuf *rb);
 static void draw_hover_popup(RenderBuf *rb);
 
+// Hash of the bytes last sent for each text row, so a redraw only sends the
+// rows that changed. Zero marks a row whose screen content is unknown.
+static uint64_t *shadow_rows;
+static int shadow_row_count;
+static int shadow_cols;
+static bool shadow_clear_pending = true;
+// View the text rows were last drawn from, to recognise a vertical scroll
+static const TextBuffer *shadow_buffer;
+static int shadow_offset_x, shadow_offset_y;
+static int shadow_start_col;
+static RenderBuf row_buf;
+
 void render_buf_init(RenderBuf *rb) {
     rb->data = NULL;
     rb->len = 0;
@@ -73,31 +87,147 @@ void render_clear_screen(RenderBuf *rb) {
     render_buf_append(rb, "\033[2J\033[H");
 }
 
-// Helper to find the token type at a given position (file coordinates)
-static SemanticTokenType get_token_at(Tab *tab, int line, int col) {
-    if (!tab || !tab->tokens || !tab->token_line_start || !tab->token_line_count) {
-        return TOKEN_UNKNOWN;
+void render_invalidate(void) {
+    shadow_clear_pending = true;
+}
+
+static uint64_t hash_row(const char *data, int len, int start_col) {
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t)start_col;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// Match the shadow to the screen size; a new size also needs a clear
+static bool shadow_resize(void) {
+    int rows = editor.screen_rows - 2;
+    if (rows < 0) rows = 0;
+    if (shadow_rows && rows == shadow_row_count && editor.screen_cols == shadow_cols) {
+        return true;
+    }
+
+    uint64_t *new_rows = calloc(rows > 0 ? rows : 1, sizeof(uint64_t));
+    if (!new_rows) return false;
+    free(shadow_rows);
+    shadow_rows = new_rows;
+    shadow_row_count = rows;
+    shadow_cols = editor.screen_cols;
+    shadow_clear_pending = true;
+    return true;
+}
+
+// Forget the text rows between two screen rows (1-based, inclusive), e.g.
+// because a popup was drawn over them
+static void shadow_invalidate_rows(int first_row, int last_row) {
+    for (int row = first_row; row <= last_row; row++) {
+        int y = row - 2;
+        if (y >= 0 && y < shadow_row_count) shadow_rows[y] = 0;
+    }
+}
+
+// Record the bytes drawn for a text row; false if the screen already shows
+// them. The hash leaves out the row position so it stays valid when the
+// content is scrolled to another row.
+static bool shadow_row_changed(int screen_y, int start_col, const RenderBuf *row) {
+    if (screen_y < 0 || screen_y >= shadow_row_count) return true;
+    uint64_t hash = hash_row(row->data, row->len, start_col);
+    if (shadow_rows[screen_y] == hash) return false;
+    shadow_rows[screen_y] = hash;
+    return true;
+}
+
+// Move the text area content up (delta > 0) or down by delta rows inside a
+// scroll region, shifting the shadow with it so only exposed rows are redrawn
+static void shadow_scroll(RenderBuf *rb, int delta) {
+    int n = shadow_row_count;
+    render_buf_appendf(rb, COLOR_RESET "\033[2;%dr", n + 1);
+    if (delta > 0) {
+        render_buf_appendf(rb, "\033[%dS", delta);
+        memmove(shadow_rows, shadow_rows + delta, (n - delta) * sizeof(uint64_t));
+        memset(shadow_rows + n - delta, 0, delta * sizeof(uint64_t));
+    } else {
+        delta = -delta;
+        render_buf_appendf(rb, "\033[%dT", delta);
+        memmove(shadow_rows + delta, shadow_rows, (n - delta) * sizeof(uint64_t));
+        memset(shadow_rows, 0, delta * sizeof(uint64_t));
     }
-    if (line < 0 || line >= tab->token_line_capacity) return TOKEN_UNKNOWN;
+    render_buf_append(rb, "\033[r");
+}
 
-    int start = tab->token_line_start[line];
-    int count = tab->token_line_count[line];
-    if (start < 0 || count <= 0) return TOKEN_UNKNOWN;
+// Run of columns on a line drawn with the same style
+typedef struct {
+    int end;            // Exclusive end column
+    const char *color;  // Token color, NULL when there are no tokens
+    bool selected;
+} StyleSpan;
+
+static StyleSpan *span_buf;
+static int span_capacity;
+
+static bool push_style_span(int *count, int end, const char *color, bool selected) {
+    if (*count > 0) {
+        StyleSpan *last = &span_buf[*count - 1];
+        if (last->color == color && last->selected == selected) {
+            last->end = end;
+            return true;
+        }
+    }
+    if (*count >= span_capacity) {
+        int new_capacity = span_capacity == 0 ? 64 : span_capacity * 2;
+        StyleSpan *new_spans = realloc(span_buf, new_capacity * sizeof(StyleSpan));
+        if (!new_spans) return false;
+        span_buf = new_spans;
+        span_capacity = new_capacity;
+    }
+    span_buf[*count] = (StyleSpan){ end, color, selected };
+    (*count)++;
+    return true;
+}
+
+// Split columns start_x..end_x of a line into runs of uniform style by
+// walking its tokens and the selection bounds together
+static int build_style_spans(Tab *tab, int file_y, int start_x, int end_x,
+                             bool has_selection, int sel_start, int sel_end) {
+    bool has_tokens = (tab->tokens != NULL && tab->token_count > 0);
+    const char *plain = has_tokens ? get_token_color(TOKEN_UNKNOWN) : NULL;
+
+    TokenCursor cursor;
+    token_cursor_init(&cursor, tab, file_y);
+
+    int count = 0;
+    int x = start_x;
+    while (x < end_x) {
+        int next = end_x;
+        const char *color = plain;
+        const StoredToken *tok = token_cursor_next(&cursor, x);
+        if (tok) {
+            int boundary = tok->col;
+            if (tok->col <= x) {
+                color = get_token_color(tok->type);
+                boundary = tok->col + tok->length;
+            }
+            if (boundary < next) next = boundary;
+        }
 
-    for (int i = start; i < start + count; i++) {
-        if (col >= tab->tokens[i].col &&
-            col < tab->tokens[i].col + tab->tokens[i].length) {
-            return tab->tokens[i].type;
+        bool selected = has_selection && x >= sel_start && x < sel_end;
+        if (has_selection) {
+            int boundary = selected ? sel_end : (x < sel_start ? sel_start : end_x);
+            if (boundary < next) next = boundary;
         }
+
+        if (!push_style_span(&count, next, color, selected)) break;
+        x = next;
     }
-    return TOKEN_UNKNOWN;
+    return count;
 }
 
-static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_col) {
+// Draws a text row at the current cursor position
+static void draw_line_to_buf(RenderBuf *rb, int file_y, int start_col) {
     Tab* tab = get_current_tab();
     if (!tab || !rb) return;
 
-    render_move_cursor(rb, screen_y + 2, start_col);
     render_buf_append(rb, "\033[K");
 
     int available_cols = editor.screen_cols - start_col + 1;
@@ -152,7 +282,8 @@ static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_
             }
 
             // Show abbreviated content with fold indicator
-            char *line = tab->buffer->lines[file_y];
+            const char *line = buffer_get_line(tab->buffer, file_y);
+            int line_len = buffer_line_length(tab->buffer, file_y);
             int folded_lines = fold->end_line - fold->start_line - 1;
             int display_len = available_cols - editor.line_number_width - 20;
             if (display_len < 10) display_len = 10;
@@ -165,7 +296,7 @@ static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_
             // Print truncated line content
             int printed = 0;
             if (line) {
-                for (int i = 0; line[i] && printed < display_len; i++, printed++) {
+                for (int i = 0; i < line_len && printed < display_len; i++, printed++) {
                     render_buf_append_char(rb, line[i]);
                 }
             }
@@ -177,9 +308,9 @@ static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_
             return;
         }
 
-        if (tab->buffer->lines[file_y]) {
-            char *line = tab->buffer->lines[file_y];
-            int len = strlen(line);
+        const char *line = buffer_get_line(tab->buffer, file_y);
+        if (line) {
+            int len = buffer_line_length(tab->buffer, file_y);
             int start_x = tab->offset_x;
             int display_len = available_cols - editor.line_number_width;
             if (display_len < 0) display_len = 0;
@@ -223,44 +354,44 @@ static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_
             int end_x = start_x + display_len;
             if (end_x > len) end_x = len;
 
-            // Render character by character with syntax highlighting
-            bool has_tokens = (tab->tokens != NULL && tab->token_count > 0);
+            // Render run by run with syntax highlighting
+            int span_count = build_style_spans(tab, file_y, start_x, end_x,
+                                               line_has_selection, sel_start, sel_end);
             const char *current_color = NULL;
             bool in_selection = false;
+            int x = start_x;
 
-            for (int x = start_x; x < end_x; x++) {
-                bool char_selected = line_has_selection && x >= sel_start && x < sel_end;
+            for (int i = 0; i < span_count; i++) {
+                const StyleSpan *span = &span_buf[i];
 
                 // Handle selection state change
-                if (char_selected != in_selection) {
-                    if (char_selected) {
+                if (span->selected != in_selection) {
+                    if (span->selected) {
                         render_buf_append(rb, "\033[7m"); // Start reverse video
                     } else {
                         render_buf_append(rb, "\033[27m"); // End reverse video
                     }
-                    in_selection = char_selected;
-                }
-
-                // Get color for this position (syntax highlighting)
-                const char *new_color = NULL;
-                if (has_tokens) {
-                    SemanticTokenType type = get_token_at(tab, file_y, x);
-                    new_color = get_token_color(type);
+                    in_selection = span->selected;
                 }
 
                 // Apply color change if needed
-                if (new_color != current_color) {
-                    if (new_color) {
-                        render_buf_append(rb, new_color);
+                if (span->color != current_color) {
+                    if (span->color) {
+                        render_buf_append(rb, span->color);
                     } else {
                         render_buf_append(rb, COLOR_RESET);
                     }
                     if (in_selection) render_buf_append(rb, "\033[7m"); // Keep selection after color changes
-                    current_color = new_color;
+                    current_color = span->color;
                 }
 
-                // Output the character
-                render_buf_append_char(rb, line[x]);
+                // Output the whole run
+                int run_len = span->end - x;
+                if (!render_buf_ensure(rb, run_len)) break;
+                memcpy(rb->data + rb->len, line + x, run_len);
+                rb->len += run_len;
+                rb->data[rb->len] = '\0';
+                x = span->end;
             }
 
             // Reset formatting
@@ -279,13 +410,24 @@ static void draw_line_to_buf(RenderBuf *rb, int screen_y, int file_y, int start_
 }
 
 void draw_line(int screen_y, int file_y, int start_col) {
-    RenderBuf rb;
-    render_buf_init(&rb);
-    draw_line_to_buf(&rb, screen_y, file_y, start_col);
-    if (rb.data && rb.len > 0) {
-        fwrite(rb.data, 1, rb.len, stdout);
+    row_buf.len = 0;
+    draw_line_to_buf(&row_buf, file_y, start_col);
+    if (row_buf.len > 0 && shadow_row_changed(screen_y, start_col, &row_buf)) {
+        printf("\033[%d;%dH", screen_y + 2, start_col);
+        fwrite(row_buf.data, 1, row_buf.len, stdout);
     }
-    render_buf_free(&rb);
+}
+
+// Render a text row into the frame unless the screen already shows it
+static void draw_text_row(RenderBuf *rb, int screen_y, int file_y, int start_col) {
+    row_buf.len = 0;
+    draw_line_to_buf(&row_buf, file_y, start_col);
+    if (row_buf.len == 0 || !shadow_row_changed(screen_y, start_col, &row_buf)) return;
+    render_move_cursor(rb, screen_y + 2, start_col);
+    if (!render_buf_ensure(rb, row_buf.len)) return;
+    memcpy(rb->data + rb->len, row_buf.data, row_buf.len);
+    rb->len += row_buf.len;
+    rb->data[rb->len] = '\0';
 }
 
 void draw_tab_bar(RenderBuf *rb) {
@@ -428,7 +570,15 @@ void draw_reload_confirmation(RenderBuf *rb) {
     
     // Construct the message with proper newlines
     static char message[512];
-    if (tab->modified) {
+    if (tab->buffer->original_mapped && tab->modified) {
+        snprintf(message, sizeof(message), 
+                "File: %s\n\nThe file is mapped; unedited lines now show its new contents.\n\n'r' to reload and lose your changes, 'k' to keep your edited lines", 
+                basename);
+    } else if (tab->buffer->original_mapped) {
+        snprintf(message, sizeof(message), 
+                "File: %s\n\nThe file is mapped and has to be reloaded.\n\nPress any key to reload", 
+                basename);
+    } else if (tab->modified) {
         snprintf(message, sizeof(message), 
                 "File: %s\n\nWarning: You have unsaved changes!\n\n'r' to reload, any other key to keep current version", 
                 basename);
@@ -480,6 +630,8 @@ void draw_modal(RenderBuf *rb, const char* title, const char* message, const cha
         start_row = editor.screen_rows - dialog_height;
     }
     
+    shadow_invalidate_rows(start_row, start_row + dialog_height - 1);
+
     // Draw dialog background
     for (int y = 0; y < dialog_height; y++) {
         render_move_cursor(rb, start_row + y, start_col);
@@ -666,6 +818,7 @@ static void draw_completion_popup(RenderBuf *rb) {
     }
     if (start_row < 2) start_row = 2;
 
+    shadow_invalidate_rows(start_row, start_row + popup_height - 1);
     for (int y = 0; y < popup_height; y++) {
         render_move_cursor(rb, start_row + y, start_col);
         render_buf_append(rb, STYLE_HOVER_BG);
@@ -744,6 +897,7 @@ static void draw_hover_popup(RenderBuf *rb) {
     }
     if (start_row < 2) start_row = 2;
 
+    shadow_invalidate_rows(start_row, start_row + popup_height - 1);
     for (int y = 0; y < popup_height; y++) {
         render_move_cursor(rb, start_row + y, start_col);
         render_buf_append(rb, STYLE_HOVER_BG);
@@ -795,8 +949,30 @@ void draw_screen(void) {
     render_buf_init(&rb);
     
     if (editor.needs_full_redraw || offset_changed) {
-        if (editor.needs_full_redraw) {
+        // Rows are diffed against the shadow; the screen is only cleared
+        // when its contents are unknown
+        bool have_shadow = shadow_resize();
+        if (!have_shadow || shadow_clear_pending) {
             render_clear_screen(&rb);
+            if (have_shadow) memset(shadow_rows, 0, shadow_row_count * sizeof(uint64_t));
+            shadow_clear_pending = false;
+        }
+
+        // Calculate text area position
+        int text_start_col = 1;
+        if (editor.file_manager_visible && !editor.file_manager_overlay_mode) {
+            text_start_col += editor.file_manager_width + 1; // +1 for border
+        }
+
+        // A vertical scroll of the same view shifts what is already on
+        // screen instead of repainting it
+        if (have_shadow && shadow_buffer == tab->buffer && shadow_offset_x == tab->offset_x &&
+            shadow_start_col == text_start_col && shadow_offset_y != tab->offset_y) {
+            int delta = file_line_to_display_line(tab, tab->offset_y) -
+                        file_line_to_display_line(tab, shadow_offset_y);
+            if (delta != 0 && abs(delta) < shadow_row_count) {
+                shadow_scroll(&rb, delta);
+            }
         }
         
         // Draw tab bar
@@ -807,12 +983,6 @@ void draw_screen(void) {
             draw_file_manager(&rb);
         }
         
-        // Calculate text area position
-        int text_start_col = 1;
-        if (editor.file_manager_visible && !editor.file_manager_overlay_mode) {
-            text_start_col += editor.file_manager_width + 1; // +1 for border
-        }
-        
         // Draw content (screen_rows - 2 to account for tab bar and status line)
         // Handle folded lines by skipping invisible ones
         int file_y = tab->offset_y;
@@ -822,7 +992,7 @@ void draw_screen(void) {
                 file_y++;
             }
 
-            draw_line_to_buf(&rb, y, file_y, text_start_col);
+            draw_text_row(&rb, y, file_y, text_start_col);
             file_y++;
         }
         
@@ -830,6 +1000,10 @@ void draw_screen(void) {
         editor.needs_full_redraw = false;
         tab->last_offset_x = tab->offset_x;
         tab->last_offset_y = tab->offset_y;
+        shadow_buffer = tab->buffer;
+        shadow_offset_x = tab->offset_x;
+        shadow_offset_y = tab->offset_y;
+        shadow_start_col = text_start_col;
     } else {
         // Just update dynamic parts without full redraw
         if (editor.file_manager_visible) {
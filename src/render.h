@@ -17,6 +17,7 @@ void render_buf_append_char(RenderBuf *rb, char c);
 void render_buf_appendf(RenderBuf *rb, const char *fmt, ...);
 void render_move_cursor(RenderBuf *rb, int row, int col);
 void render_clear_screen(RenderBuf *rb);
+void render_invalidate(void);
 
 void draw_screen(void);
 void draw_line(int screen_y, int file_y, int start_col);
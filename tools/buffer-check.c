@@ -0,0 +1,112 @@
+/*
+ * buffer-check: what a loaded buffer sees when its file changes on disk
+ *
+ * Run by `make check`. Loads a file, rewrites it in place, truncates it and
+ * reads every line back, once through the default heap loader and once
+ * through a file mapping. The heap buffer must keep its text; the mapped
+ * buffer must survive the truncation and report it.
+ */
+
+#define _GNU_SOURCE
+#include "../src/buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_COUNT 2000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void line_text(int row, char c, char *out, size_t size) {
+    snprintf(out, size, "%c%c%c line %d", c, c, c, row);
+}
+
+static bool write_file(const char *path, char c) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    char text[64];
+    for (int i = 0; i < LINE_COUNT; i++) {
+        line_text(i, c, text, sizeof(text));
+        fprintf(file, "%s\n", text);
+    }
+    return fclose(file) == 0;
+}
+
+// Overwrite the file's bytes without truncating it, as an editor that
+// saves in place would
+static bool rewrite_in_place(const char *path, char c) {
+    FILE *file = fopen(path, "r+");
+    if (!file) return false;
+    char text[64];
+    for (int i = 0; i < LINE_COUNT; i++) {
+        line_text(i, c, text, sizeof(text));
+        fprintf(file, "%s\n", text);
+    }
+    return fclose(file) == 0;
+}
+
+// Read every line the way the renderer does; returns whether all of them
+// still hold the text written with c
+static bool lines_match(TextBuffer *buffer, char c) {
+    char text[64];
+    bool match = buffer->line_count == LINE_COUNT;
+    for (int i = 0; i < buffer->line_count; i++) {
+        const char *line = buffer_get_line(buffer, i);
+        int len = buffer_line_length(buffer, i);
+        line_text(i, c, text, sizeof(text));
+        bool same = len == (int)strlen(text) && memcmp(line, text, len) == 0;
+        match = match && same;
+    }
+    return match;
+}
+
+int main(void) {
+    char path[] = "/tmp/buffer-check-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    // Default loader: the buffer is a snapshot of the file
+    buffer_set_map_threshold(0);
+    check(write_file(path, 'a'), "write file");
+    TextBuffer *buffer = buffer_create();
+    check(buffer_load_from_file(buffer, path), "heap: load");
+    check(!buffer->original_mapped, "heap: not mapped by default");
+    check(rewrite_in_place(path, 'b'), "heap: rewrite in place");
+    check(lines_match(buffer, 'a'), "heap: lines unchanged after rewrite");
+    check(truncate(path, 0) == 0, "heap: truncate");
+    check(lines_match(buffer, 'a'), "heap: lines unchanged after truncate");
+    check(!buffer->original_lost, "heap: nothing lost");
+    buffer_free(buffer);
+
+    // Mapped loader: truncation must not kill the process
+    buffer_set_map_threshold(1);
+    check(write_file(path, 'a'), "rewrite file");
+    buffer = buffer_create();
+    check(buffer_load_from_file(buffer, path), "mapped: load");
+    check(buffer->original_mapped, "mapped: mapped past the threshold");
+    check(lines_match(buffer, 'a'), "mapped: lines after load");
+    check(rewrite_in_place(path, 'b'), "mapped: rewrite in place");
+    check(truncate(path, 0) == 0, "mapped: truncate");
+    check(!lines_match(buffer, 'a') && !lines_match(buffer, 'b'),
+          "mapped: truncated lines read as zeros");
+    check(buffer->original_lost, "mapped: truncation reported");
+    check(!buffer_save_to_file(buffer, path), "mapped: save refused after truncation");
+    buffer_free(buffer);
+
+    unlink(path);
+    if (failures > 0) return 1;
+    printf("buffer-check: ok\n");
+    return 0;
+}
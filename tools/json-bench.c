@@ -0,0 +1,129 @@
+/*
+ * json-bench: throughput of json_parse on LSP-shaped messages
+ *
+ * Built twice by `make bench`, once as is and once with -DJSON_NO_SIMD,
+ * to compare the vector string and whitespace scans against the scalar
+ * ones.
+ */
+
+#define _GNU_SOURCE
+#include "../src/json.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 15
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Text;
+
+static void text_append(Text *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_append(Text *t, const char *fmt, ...) {
+    va_list ap;
+    while (1) {
+        va_start(ap, fmt);
+        int n = vsnprintf(t->buf + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && (size_t)n < t->cap - t->len) {
+            t->len += n;
+            return;
+        }
+        t->cap = t->cap == 0 ? 4096 : t->cap * 2;
+        t->buf = realloc(t->buf, t->cap);
+        if (!t->buf) exit(1);
+    }
+}
+
+// Markdown-ish documentation with an escaped newline every few lines
+static void append_doc(Text *t, int words) {
+    static const char *vocab[] = { "returns", "the", "value", "of", "`buffer`", "when",
+                                   "called", "with", "a", "valid", "index", "otherwise", "null" };
+    for (int i = 0; i < words; i++) {
+        text_append(t, "%s%s", vocab[(i * 7) % 13], i % 12 == 11 ? "\\n" : " ");
+    }
+}
+
+// Pretty-printed completion list, as tsserver and friends send it
+static char *make_completion(int items) {
+    Text t = {0};
+    text_append(&t, "{\n  \"jsonrpc\": \"2.0\",\n  \"id\": 42,\n  \"result\": {\n    \"isIncomplete\": false,\n    \"items\": [\n");
+    for (int i = 0; i < items; i++) {
+        text_append(&t, "      {\n        \"label\": \"completionItem%d\",\n        \"kind\": %d,\n", i, i % 25);
+        text_append(&t, "        \"detail\": \"function completionItem%d(arg: string, count: number): Promise<void>\",\n", i);
+        text_append(&t, "        \"documentation\": {\n          \"kind\": \"markdown\",\n          \"value\": \"");
+        append_doc(&t, 40 + i % 200);
+        text_append(&t, "\"\n        }\n      }%s\n", i + 1 < items ? "," : "");
+    }
+    text_append(&t, "    ]\n  }\n}\n");
+    return t.buf;
+}
+
+// One large hover string
+static char *make_hover(int words) {
+    Text t = {0};
+    text_append(&t, "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":{\"contents\":{\"kind\":\"markdown\",\"value\":\"");
+    append_doc(&t, words);
+    text_append(&t, "\"}}}");
+    return t.buf;
+}
+
+// Compact diagnostics notification
+static char *make_diagnostics(int count) {
+    Text t = {0};
+    text_append(&t, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":"
+                    "{\"uri\":\"file:///src/main.c\",\"diagnostics\":[");
+    for (int i = 0; i < count; i++) {
+        text_append(&t, "%s{\"range\":{\"start\":{\"line\":%d,\"character\":4},\"end\":{\"line\":%d,"
+                        "\"character\":12}},\"severity\":%d,\"source\":\"clang\",\"message\":"
+                        "\"use of undeclared identifier 'value%d'\"}",
+                    i ? "," : "", i, i, 1 + i % 4, i);
+    }
+    text_append(&t, "]}}");
+    return t.buf;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, char *text) {
+    size_t len = strlen(text);
+    JsonArena *arena = json_arena_create();
+    double best = 1e9;
+    for (int i = 0; i < RUNS; i++) {
+        double start = now_sec();
+        json_use_arena(arena);
+        JsonValue *v = json_parse(text);
+        json_use_arena(NULL);
+        if (!v) {
+            fprintf(stderr, "%s: parse failed\n", name);
+            exit(1);
+        }
+        json_arena_reset(arena);
+        double elapsed = now_sec() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    json_arena_free(arena);
+    printf("  %-12s %8.2f MB  %8.3f ms  %8.1f MB/s\n", name, len / 1e6, best * 1e3, len / 1e6 / best);
+    free(text);
+}
+
+int main(void) {
+#ifdef JSON_NO_SIMD
+    printf("json_parse (scalar scans)\n");
+#else
+    printf("json_parse (vector scans where supported)\n");
+#endif
+    bench("completion", make_completion(20000));
+    bench("hover", make_hover(400000));
+    bench("diagnostics", make_diagnostics(20000));
+    return 0;
+}